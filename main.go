@@ -1,10 +1,14 @@
 package main
 
-import "fmt"
+import (
+	"context"
+	"fmt"
+)
 
 func main() {
 	ExampleUsingDynamicFpe()
 	//ExampleUsingStaticFpe()
+	//ExampleUsingRegistryFile()
 }
 
 func ExampleUsingStaticFpe() {
@@ -15,14 +19,18 @@ func ExampleUsingStaticFpe() {
 	sharedSecret := "voltage123"
 	format := "alphanumeric"
 
-	fpe := NewVoltageFPE(
-		voltageURL,
-		trustPath,
-		cachePath,
-		identity,
-		sharedSecret,
-		format,
-	)
+	fpe, err := NewVoltageFPEWithConfig(ContextConfig{
+		PolicyURL:      voltageURL,
+		TrustStorePath: trustPath,
+		CachePath:      cachePath,
+		Identity:       identity,
+		SharedSecret:   sharedSecret,
+		Format:         format,
+	})
+	if err != nil {
+		fmt.Println("Voltage:", err)
+		return
+	}
 	defer fpe.Close()
 
 	plaintext := "12-10-2005 10:27:33"
@@ -48,3 +56,23 @@ func ExampleUsingDynamicFpe() {
 	fmt.Println("Original: ", plain)
 	fmt.Println("Cipher:   ", cipher)
 }
+
+func ExampleUsingRegistryFile() {
+	futures, err := LoadRegistry("registry.example.json")
+	if err != nil {
+		fmt.Println("Registry:", err)
+		return
+	}
+	if err := futures["fpe-dev"].Wait(context.Background()); err != nil {
+		fmt.Println("Registry:", err)
+		return
+	}
+
+	cipher, _ := EncryptByID("fpe-dev", "12-10-2005 10:27:33")
+	plain, _ := DecryptByID("fpe-dev", cipher)
+
+	DeleteAllFPEs() // --> optional
+
+	fmt.Println("Original: ", plain)
+	fmt.Println("Cipher:   ", cipher)
+}
@@ -0,0 +1,112 @@
+package main
+
+import (
+	"errors"
+	"slices"
+	"sync"
+	"time"
+)
+
+const (
+	adaptiveSamples  = 128
+	adaptiveEvery    = 16
+	adaptiveMinBatch = 1
+)
+
+// coalesceController tunes a Coalescer's window and batch limit with AIMD.
+// Every adaptiveEvery batches it estimates the p99 wait from the recent
+// per-batch worst waits. Over target, it halves the window. It cuts the
+// limit by a quarter only when nobody is queueing and the window is already
+// at its floor, i.e. when the batches themselves are too slow. Under load,
+// shrinking batches would only lengthen the queue, so the limit grows
+// instead. Within target, the settings grow additively while callers are
+// backing up, and the window shrinks while batches are too small to be
+// worth waiting for. The samples are dropped after a decrease so the next
+// estimate reflects the new settings.
+type coalesceController struct {
+	target    time.Duration
+	minWindow time.Duration
+	maxWindow time.Duration
+	maxBatch  int
+
+	mu      sync.Mutex
+	samples [adaptiveSamples]time.Duration
+	count   int
+	next    int
+	since   int
+	sizes   int
+	backlog int64
+	p99     time.Duration
+}
+
+func NewAdaptiveCoalescer(fpe *VoltageFPE, target, maxWindow time.Duration, maxBatch int) (*Coalescer, error) {
+	if target <= 0 || maxWindow <= 0 || maxBatch < 1 {
+		return nil, errors.New("adaptive coalescer target, window and batch size must be positive")
+	}
+	minWindow := min(maxWindow, 10*time.Microsecond)
+	c, err := NewCoalescer(fpe, maxWindow, maxBatch)
+	if err != nil {
+		return nil, err
+	}
+	// Start small and let load earn a longer window.
+	c.curWindow.Store(int64(minWindow))
+	c.curLimit.Store(int64(min(maxBatch, 16)))
+	c.ctl = &coalesceController{target: target, minWindow: minWindow, maxWindow: maxWindow, maxBatch: maxBatch}
+	return c, nil
+}
+
+func (a *coalesceController) observe(c *Coalescer, size int, worst time.Duration, backlog int64) {
+	a.mu.Lock()
+	defer a.mu.Unlock()
+
+	a.samples[a.next] = worst
+	a.next = (a.next + 1) % adaptiveSamples
+	a.count = min(a.count+1, adaptiveSamples)
+
+	a.since++
+	a.sizes += size
+	a.backlog += backlog
+	if a.since < adaptiveEvery {
+		return
+	}
+
+	window := time.Duration(c.curWindow.Load())
+	limit := int(c.curLimit.Load())
+	a.p99 = a.quantile()
+	headroom := a.p99 < a.target*3/4
+	switch {
+	case a.p99 > a.target:
+		window = max(a.minWindow, window/2)
+		if a.backlog > 0 {
+			limit = min(a.maxBatch, limit+max(1, limit/8))
+		} else if window == a.minWindow {
+			limit = max(adaptiveMinBatch, limit*3/4)
+		}
+		a.count, a.next = 0, 0
+	case a.backlog > 0 && headroom:
+		limit = min(a.maxBatch, limit+max(1, limit/8))
+		window = min(a.maxWindow, window+a.minWindow)
+	case a.sizes < 2*a.since:
+		window = max(a.minWindow, window/2)
+	}
+	a.since, a.sizes, a.backlog = 0, 0, 0
+	a.store(c, window, limit)
+}
+
+func (a *coalesceController) store(c *Coalescer, window time.Duration, limit int) {
+	c.curWindow.Store(int64(window))
+	c.curLimit.Store(int64(limit))
+}
+
+func (a *coalesceController) quantile() time.Duration {
+	sorted := make([]time.Duration, a.count)
+	copy(sorted, a.samples[:a.count])
+	slices.Sort(sorted)
+	return sorted[(len(sorted)*99)/100]
+}
+
+func (a *coalesceController) estimate() time.Duration {
+	a.mu.Lock()
+	defer a.mu.Unlock()
+	return a.p99
+}
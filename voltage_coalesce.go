@@ -0,0 +1,286 @@
+package main
+
+import (
+	"errors"
+	"sync"
+	"sync/atomic"
+	"time"
+)
+
+// CoalescerStats are cumulative counters for a Coalescer. Values/Batches is
+// the mean window size and WaitTime/Values the mean time a caller waited for
+// its batch, including the native call. Window and BatchLimit are the current
+// settings, which an adaptive coalescer retunes; ObservedP99 is its latest
+// estimate of per-batch worst-case wait.
+type CoalescerStats struct {
+	Batches     uint64
+	Values      uint64
+	MaxBatch    uint64
+	WaitTime    time.Duration
+	Window      time.Duration
+	BatchLimit  int
+	ObservedP99 time.Duration
+}
+
+type coalescedCall struct {
+	value    string
+	enqueued time.Time
+	result   string
+	status   Status
+	done     chan struct{}
+}
+
+var coalescedCalls = sync.Pool{New: func() any {
+	return &coalescedCall{done: make(chan struct{}, 1)}
+}}
+
+// Coalescer collects concurrent single-value calls on one VoltageFPE for up
+// to window, or until maxBatch calls are waiting, and sends them as a single
+// native batch.
+type Coalescer struct {
+	fpe      *VoltageFPE
+	window   time.Duration
+	maxBatch int
+	protect  chan *coalescedCall
+	access   chan *coalescedCall
+	stop     chan struct{}
+	stopped  sync.WaitGroup
+	ctl      *coalesceController
+
+	curWindow atomic.Int64
+	curLimit  atomic.Int64
+	waiting   atomic.Int64
+
+	batches  atomic.Uint64
+	values   atomic.Uint64
+	maxSeen  atomic.Uint64
+	waitTime atomic.Int64
+}
+
+func NewCoalescer(fpe *VoltageFPE, window time.Duration, maxBatch int) (*Coalescer, error) {
+	if window <= 0 || maxBatch < 1 {
+		return nil, errors.New("coalescer window and batch size must be positive")
+	}
+	c := &Coalescer{
+		fpe:      fpe,
+		window:   window,
+		maxBatch: maxBatch,
+		protect:  make(chan *coalescedCall),
+		access:   make(chan *coalescedCall),
+		stop:     make(chan struct{}),
+	}
+	c.curWindow.Store(int64(window))
+	c.curLimit.Store(int64(maxBatch))
+	c.stopped.Add(2)
+	go c.run(true, c.protect)
+	go c.run(false, c.access)
+	return c, nil
+}
+
+// do hands value to the collecting goroutine. The channels are unbuffered, so
+// once stop is closed no call can be accepted and left unanswered; ok is false
+// and the caller falls back to a direct call.
+func (c *Coalescer) do(protect bool, value string) (result string, status Status, ok bool) {
+	call := coalescedCalls.Get().(*coalescedCall)
+	call.value = value
+	call.enqueued = time.Now()
+
+	in := c.access
+	if protect {
+		in = c.protect
+	}
+	c.waiting.Add(1)
+	select {
+	case in <- call:
+	case <-c.stop:
+		c.waiting.Add(-1)
+		call.value = ""
+		coalescedCalls.Put(call)
+		return "", 0, false
+	}
+	<-call.done
+	c.waiting.Add(-1)
+
+	result, status = call.result, call.status
+	call.value, call.result = "", ""
+	coalescedCalls.Put(call)
+	return result, status, true
+}
+
+func (c *Coalescer) run(protect bool, in chan *coalescedCall) {
+	defer c.stopped.Done()
+
+	batch := make([]*coalescedCall, 0, c.maxBatch)
+	values := make([]string, c.maxBatch)
+	timer := time.NewTimer(c.window)
+	timer.Stop()
+	for {
+		select {
+		case call := <-in:
+			batch = append(batch, call)
+		case <-c.stop:
+			return
+		}
+
+		limit := int(c.curLimit.Load())
+		timer.Reset(time.Duration(c.curWindow.Load()))
+	collect:
+		for len(batch) < limit {
+			select {
+			case call := <-in:
+				batch = append(batch, call)
+			case <-timer.C:
+				break collect
+			}
+		}
+		if !timer.Stop() {
+			select {
+			case <-timer.C:
+			default:
+			}
+		}
+
+		c.flush(protect, batch, values[:len(batch)])
+		batch = batch[:0]
+	}
+}
+
+func (c *Coalescer) flush(protect bool, batch []*coalescedCall, values []string) {
+	for i, call := range batch {
+		values[i] = call.value
+	}
+
+	var results []string
+	var statuses []Status
+	var err error
+	if protect {
+		results, statuses, err = c.fpe.ProtectBatchStatuses(values)
+	} else {
+		results, statuses, err = c.fpe.AccessBatch(values)
+	}
+	for i, call := range batch {
+		if err != nil {
+			// Only batch-level failures land here; give every caller its
+			// own result rather than a shared error.
+			var status int
+			call.result, status = c.fpe.single(protect, "", call.value, "", false)
+			call.status = Status(status)
+		} else {
+			call.result, call.status = results[i], statuses[i]
+		}
+	}
+
+	now := time.Now()
+	var wait, worst time.Duration
+	for i, call := range batch {
+		w := now.Sub(call.enqueued)
+		wait += w
+		worst = max(worst, w)
+		values[i] = ""
+		call.done <- struct{}{}
+	}
+	if c.ctl != nil {
+		c.ctl.observe(c, len(batch), worst, c.waiting.Load()-int64(len(batch)))
+	}
+
+	n := uint64(len(batch))
+	c.batches.Add(1)
+	c.values.Add(n)
+	c.waitTime.Add(int64(wait))
+	for {
+		m := c.maxSeen.Load()
+		if n <= m || c.maxSeen.CompareAndSwap(m, n) {
+			break
+		}
+	}
+}
+
+func (c *Coalescer) Stats() CoalescerStats {
+	stats := CoalescerStats{
+		Batches:    c.batches.Load(),
+		Values:     c.values.Load(),
+		MaxBatch:   c.maxSeen.Load(),
+		WaitTime:   time.Duration(c.waitTime.Load()),
+		Window:     time.Duration(c.curWindow.Load()),
+		BatchLimit: int(c.curLimit.Load()),
+	}
+	if c.ctl != nil {
+		stats.ObservedP99 = c.ctl.estimate()
+	}
+	return stats
+}
+
+func (c *Coalescer) Close() {
+	close(c.stop)
+	c.stopped.Wait()
+}
+
+// EnableCoalescing routes Protect and Access through a Coalescer. It is
+// meant for many goroutines issuing single values; a lone caller pays up to
+// window of extra latency per call.
+func (v *VoltageFPE) EnableCoalescing(window time.Duration, maxBatch int) error {
+	c, err := NewCoalescer(v, window, maxBatch)
+	if err != nil {
+		return err
+	}
+	if old := v.coalescer.Swap(c); old != nil {
+		old.Close()
+	}
+	return nil
+}
+
+// EnableAdaptiveCoalescing is EnableCoalescing with the window and batch size
+// retuned from observed latency and backlog so that the per-batch p99 wait
+// stays under target; maxWindow and maxBatch bound what the controller picks.
+func (v *VoltageFPE) EnableAdaptiveCoalescing(target, maxWindow time.Duration, maxBatch int) error {
+	c, err := NewAdaptiveCoalescer(v, target, maxWindow, maxBatch)
+	if err != nil {
+		return err
+	}
+	if old := v.coalescer.Swap(c); old != nil {
+		old.Close()
+	}
+	return nil
+}
+
+func (v *VoltageFPE) DisableCoalescing() {
+	if c := v.coalescer.Swap(nil); c != nil {
+		c.Close()
+	}
+}
+
+// CoalescerStats reports the counters of the active coalescer, if any.
+func (v *VoltageFPE) CoalescerStats() (CoalescerStats, bool) {
+	if c := v.coalescer.Load(); c != nil {
+		return c.Stats(), true
+	}
+	return CoalescerStats{}, false
+}
+
+func EnableCoalescingByID(id string, window time.Duration, maxBatch int) error {
+	e, err := acquireByID(id)
+	if err != nil {
+		return err
+	}
+	defer e.release()
+	return e.fpe.EnableCoalescing(window, maxBatch)
+}
+
+func EnableAdaptiveCoalescingByID(id string, target, maxWindow time.Duration, maxBatch int) error {
+	e, err := acquireByID(id)
+	if err != nil {
+		return err
+	}
+	defer e.release()
+	return e.fpe.EnableAdaptiveCoalescing(target, maxWindow, maxBatch)
+}
+
+func CoalescerStatsByID(id string) (CoalescerStats, bool, error) {
+	e, err := acquireByID(id)
+	if err != nil {
+		return CoalescerStats{}, false, err
+	}
+	defer e.release()
+	stats, ok := e.fpe.CoalescerStats()
+	return stats, ok, nil
+}
@@ -0,0 +1,269 @@
+package main
+
+import (
+	"context"
+	"encoding/json"
+	"errors"
+	"fmt"
+	"os"
+	"sync"
+	"sync/atomic"
+	"time"
+)
+
+// ErrNotReady is returned by ByID calls for a registration that is still
+// being built and is configured to fail fast rather than wait.
+var ErrNotReady = errors.New("FPE registration is not ready yet")
+
+// RegistryConfig is the declarative form of a set of RegisterFPE calls:
+//
+//	{"registrations": [{"id": "fpe-dev", "policyURL": "...", "trustStore": "...",
+//	  "cachePath": "...", "identity": "...", "sharedSecretEnv": "FPE_DEV_SECRET",
+//	  "format": "alphanumeric", "directions": ["protect", "access"],
+//	  "init": "eager", "onNotReady": "wait"}]}
+type RegistryConfig struct {
+	Registrations []RegistrationConfig `json:"registrations"`
+}
+
+type RegistrationConfig struct {
+	ID              string   `json:"id"`
+	PolicyURL       string   `json:"policyURL"`
+	TrustStore      string   `json:"trustStore"`
+	CachePath       string   `json:"cachePath"`
+	Identity        string   `json:"identity"`
+	SharedSecret    string   `json:"sharedSecret"`
+	SharedSecretEnv string   `json:"sharedSecretEnv"`
+	Format          string   `json:"format"`
+	Directions      []string `json:"directions"` // "protect", "access"; empty means both
+	Init            string   `json:"init"`       // "eager" (default) builds in the background, "lazy" on first use
+	OnNotReady      string   `json:"onNotReady"` // "wait" (default) blocks callers until ready, "fail" returns ErrNotReady
+}
+
+const (
+	registrationRetryMinDelay = time.Second
+	registrationRetryMaxDelay = time.Minute
+)
+
+// Readiness is the future for one configured registration. A build that
+// fails with a retryable status, such as a key server that is briefly
+// unreachable at boot, is rebuilt in the background with backoff; until
+// then callers get the failed attempt's error.
+type Readiness struct {
+	ID     string
+	config RegistrationConfig
+	wait   bool
+
+	mu        sync.Mutex
+	attempt   *readinessAttempt
+	failures  int
+	cancelled atomic.Bool // set under registryLock by DeleteAllFPEs
+}
+
+type readinessAttempt struct {
+	done chan struct{}
+	err  error
+}
+
+var pendingFPEs sync.Map // id -> *Readiness
+
+func (r *Readiness) start() *readinessAttempt {
+	r.mu.Lock()
+	defer r.mu.Unlock()
+	if r.attempt == nil {
+		r.attempt = &readinessAttempt{done: make(chan struct{})}
+		go r.build(r.attempt)
+	}
+	return r.attempt
+}
+
+func (r *Readiness) build(a *readinessAttempt) {
+	defer close(a.done)
+
+	err := r.register()
+	if err == nil {
+		r.mu.Lock()
+		r.failures = 0
+		r.mu.Unlock()
+		return
+	}
+	a.err = fmt.Errorf("registering FPE '%s': %w", r.ID, err)
+	if !retryable(err) || r.cancelled.Load() {
+		return
+	}
+
+	r.mu.Lock()
+	delay := min(registrationRetryMinDelay<<min(r.failures, 6), registrationRetryMaxDelay)
+	r.failures++
+	r.mu.Unlock()
+	time.AfterFunc(delay, func() {
+		if r.cancelled.Load() {
+			return
+		}
+		r.mu.Lock()
+		if r.attempt == a {
+			r.attempt = nil
+		}
+		r.mu.Unlock()
+		r.start()
+	})
+}
+
+func (r *Readiness) register() error {
+	c := r.config
+	secret := c.SharedSecret
+	if c.SharedSecretEnv != "" {
+		secret = os.Getenv(c.SharedSecretEnv)
+	}
+	protect, access, err := parseDirections(c.Directions)
+	if err != nil {
+		return err
+	}
+
+	fpe, err := createVoltageFPE(c.PolicyURL, c.TrustStore, c.CachePath, c.Identity, secret, c.Format)
+	if err != nil {
+		return err
+	}
+	if err := fpe.Materialize("", protect, access); err != nil {
+		fpe.Close()
+		return err
+	}
+	if _, ok := publishIf(r.ID, fpe, func() bool { return !r.cancelled.Load() }); !ok {
+		fpe.Close()
+		return errors.New("registration was deleted")
+	}
+	return nil
+}
+
+// parseDirections maps a list of "protect" and "access" to the directions
+// to materialize; an empty list means both.
+func parseDirections(directions []string) (protect, access bool, err error) {
+	if len(directions) == 0 {
+		return true, true, nil
+	}
+	for _, d := range directions {
+		switch d {
+		case "protect":
+			protect = true
+		case "access":
+			access = true
+		default:
+			return false, false, fmt.Errorf("unknown direction '%s'", d)
+		}
+	}
+	return protect, access, nil
+}
+
+// retryable reports whether err carries a Status worth retrying.
+func retryable(err error) bool {
+	var s Status
+	return errors.As(err, &s) && s.Retryable()
+}
+
+// Done returns a channel closed once the current build attempt has succeeded
+// or failed; asking for it starts a lazy registration.
+func (r *Readiness) Done() <-chan struct{} {
+	return r.start().done
+}
+
+// Err is the error of the current build attempt, valid once Done is closed.
+func (r *Readiness) Err() error {
+	r.mu.Lock()
+	a := r.attempt
+	r.mu.Unlock()
+	if a == nil {
+		return ErrNotReady
+	}
+	select {
+	case <-a.done:
+		return a.err
+	default:
+		return ErrNotReady
+	}
+}
+
+func (r *Readiness) Wait(ctx context.Context) error {
+	a := r.start()
+	select {
+	case <-a.done:
+		return a.err
+	case <-ctx.Done():
+		return ctx.Err()
+	}
+}
+
+// await is what a ByID call does on a miss: start the build, then either
+// wait for it or fail fast, as the registration is configured.
+func (r *Readiness) await() error {
+	a := r.start()
+	if !r.wait {
+		select {
+		case <-a.done:
+		default:
+			return ErrNotReady
+		}
+	}
+	<-a.done
+	return a.err
+}
+
+func parseRegistrationConfig(c RegistrationConfig) (*Readiness, error) {
+	if c.ID == "" {
+		return nil, errors.New("registration without an id")
+	}
+	if _, _, err := parseDirections(c.Directions); err != nil {
+		return nil, fmt.Errorf("registration '%s': %w", c.ID, err)
+	}
+	if c.Init != "" && c.Init != "eager" && c.Init != "lazy" {
+		return nil, fmt.Errorf("registration '%s': unknown init '%s'", c.ID, c.Init)
+	}
+	if c.OnNotReady != "" && c.OnNotReady != "wait" && c.OnNotReady != "fail" {
+		return nil, fmt.Errorf("registration '%s': unknown onNotReady '%s'", c.ID, c.OnNotReady)
+	}
+	return &Readiness{ID: c.ID, config: c, wait: c.OnNotReady != "fail"}, nil
+}
+
+// LoadRegistry reads a RegistryConfig from path and registers every entry
+// behind a readiness future. Eager entries start building in the background
+// immediately; lazy ones on first use. It returns without waiting, so the
+// process can serve the registrations that are ready while others build.
+func LoadRegistry(path string) (map[string]*Readiness, error) {
+	data, err := os.ReadFile(path)
+	if err != nil {
+		return nil, err
+	}
+	var config RegistryConfig
+	if err := json.Unmarshal(data, &config); err != nil {
+		return nil, fmt.Errorf("parsing registry config %s: %w", path, err)
+	}
+	return ApplyRegistry(config)
+}
+
+func ApplyRegistry(config RegistryConfig) (map[string]*Readiness, error) {
+	futures := make(map[string]*Readiness, len(config.Registrations))
+	for _, c := range config.Registrations {
+		r, err := parseRegistrationConfig(c)
+		if err != nil {
+			return nil, err
+		}
+		if _, dup := futures[c.ID]; dup {
+			return nil, fmt.Errorf("registration '%s' is listed twice", c.ID)
+		}
+		futures[c.ID] = r
+	}
+	for id, r := range futures {
+		pendingFPEs.Store(id, r)
+		if r.config.Init != "lazy" {
+			r.start()
+		}
+	}
+	return futures, nil
+}
+
+// ReadinessByID returns the future of a configured registration, or nil if id
+// was not loaded from a registry config.
+func ReadinessByID(id string) *Readiness {
+	if r, ok := pendingFPEs.Load(id); ok {
+		return r.(*Readiness)
+	}
+	return nil
+}
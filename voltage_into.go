@@ -0,0 +1,97 @@
+package main
+
+/*
+#cgo noescape VoltageProtectInto
+#cgo noescape VoltageAccessInto
+#cgo noescape VoltageAccessMaskedInto
+#cgo nocallback VoltageProtectInto
+#cgo nocallback VoltageAccessInto
+#cgo nocallback VoltageAccessMaskedInto
+#include <stdlib.h>
+#include "voltage_fpe.h"
+*/
+import "C"
+import (
+	"fmt"
+	"unsafe"
+)
+
+type intoCall func(input *C.uchar, inputSize C.uint, out *C.uchar, outSize C.uint, outLen *C.uint) C.int
+
+// into appends the result of call to dst, writing it straight into the spare
+// capacity of dst. dst grows up front when that capacity is below the
+// format's output bound, so the vendor operation normally runs once, and the
+// Into entry points are marked noescape so outLen stays on the stack; a
+// caller reusing its buffer makes no Go allocation per value.
+func (v *VoltageFPE) into(op, format string, dst, src []byte, call intoCall) ([]byte, error) {
+	input := (*C.uchar)(unsafe.Pointer(&emptyInput))
+	if len(src) > 0 {
+		input = (*C.uchar)(unsafe.Pointer(&src[0]))
+	}
+	scale, slack := v.formatSizing(format)
+	if need := scale*len(src) + slack; cap(dst)-len(dst) < need {
+		grown := make([]byte, len(dst), len(dst)+need)
+		copy(grown, dst)
+		dst = grown
+	}
+	for {
+		spare := dst[len(dst):cap(dst)]
+		out := (*C.uchar)(unsafe.Pointer(&emptyInput))
+		if len(spare) > 0 {
+			out = (*C.uchar)(unsafe.Pointer(&spare[0]))
+		}
+		var outLen C.uint
+		status := call(input, C.uint(len(src)), out, C.uint(len(spare)), &outLen)
+		if status == C.VE_ERROR_BUFFER_TOO_SMALL && len(spare) < C.VOLTAGE_MAX_OUTPUT_SIZE {
+			grown := make([]byte, len(dst), len(dst)+max(2*len(spare), 2*len(src)+16))
+			copy(grown, dst)
+			dst = grown
+			continue
+		}
+		if status != 0 {
+			v.noteStatus(Status(status))
+			return dst, fmt.Errorf("voltage %s failed with status %d", op, int(status))
+		}
+		return dst[:len(dst)+int(outLen)], nil
+	}
+}
+
+// ProtectInto appends the ciphertext of src under the default format to dst.
+func (v *VoltageFPE) ProtectInto(dst, src []byte) ([]byte, error) {
+	return v.into("protect", "", dst, src, func(input *C.uchar, inputSize C.uint, out *C.uchar, outSize C.uint, outLen *C.uint) C.int {
+		return C.VoltageProtectInto(v.ctx, nil, input, inputSize, nil, 0, out, outSize, outLen)
+	})
+}
+
+func (v *VoltageFPE) AccessInto(dst, src []byte) ([]byte, error) {
+	return v.into("access", "", dst, src, func(input *C.uchar, inputSize C.uint, out *C.uchar, outSize C.uint, outLen *C.uint) C.int {
+		return C.VoltageAccessInto(v.ctx, nil, input, inputSize, nil, 0, out, outSize, outLen)
+	})
+}
+
+func (v *VoltageFPE) AccessMaskedInto(dst, src []byte) ([]byte, error) {
+	return v.into("masked access", "", dst, src, func(input *C.uchar, inputSize C.uint, out *C.uchar, outSize C.uint, outLen *C.uint) C.int {
+		return C.VoltageAccessMaskedInto(v.ctx, nil, input, inputSize, nil, 0, out, outSize, outLen)
+	})
+}
+
+// ProtectFormatInto is ProtectInto for a named format.
+func (v *VoltageFPE) ProtectFormatInto(format string, dst, src []byte) ([]byte, error) {
+	name, owned := v.cFormat(format)
+	if owned {
+		defer C.free(unsafe.Pointer(name))
+	}
+	return v.into("protect", format, dst, src, func(input *C.uchar, inputSize C.uint, out *C.uchar, outSize C.uint, outLen *C.uint) C.int {
+		return C.VoltageProtectInto(v.ctx, name, input, inputSize, nil, 0, out, outSize, outLen)
+	})
+}
+
+func (v *VoltageFPE) AccessFormatInto(format string, dst, src []byte) ([]byte, error) {
+	name, owned := v.cFormat(format)
+	if owned {
+		defer C.free(unsafe.Pointer(name))
+	}
+	return v.into("access", format, dst, src, func(input *C.uchar, inputSize C.uint, out *C.uchar, outSize C.uint, outLen *C.uint) C.int {
+		return C.VoltageAccessInto(v.ctx, name, input, inputSize, nil, 0, out, outSize, outLen)
+	})
+}
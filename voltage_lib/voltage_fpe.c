@@ -1,84 +1,1901 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 #include "voltage_fpe.h"
 #include "veapi.h"
 #include "vefpe.h"
 
-VoltageFPEContext* CreateVoltageFPEContext(
+// VoltageBreaker is the pool key of a library context together with the
+// circuit breaker for its key server. Breakers are never freed, so a key
+// server that is down keeps its open breaker across failed VeCreateLibCtx
+// calls, after the pool entry itself has been dropped.
+typedef struct VoltageBreaker {
+    char* policyURL;
+    char* policyFilePath;
+    char* trustStorePath;
+    char* cachePath;
+    int networkTimeout;
+    unsigned int failures;
+    int64_t openUntil;
+    int probing;
+    struct VoltageBreaker* next;
+} VoltageBreaker;
+
+struct VoltageLibCtxEntry {
+    VoltageBreaker* breaker;
+    VeLibCtx libctx;
+    int status;
+    int ready;
+    int refs;
+    struct VoltageLibCtxEntry* next;
+};
+
+static VoltageBreaker* breakers = NULL;
+static VoltageLibCtxEntry* libCtxPool = NULL;
+static pthread_mutex_t libCtxPoolLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t libCtxPoolReady = PTHREAD_COND_INITIALIZER;
+
+static int sameString(const char* a, const char* b) {
+    if (!a || !b) return a == b;
+    return strcmp(a, b) == 0;
+}
+
+static char* dupString(const char* s) {
+    return s ? strdup(s) : NULL;
+}
+
+static void freeLibCtxEntry(VoltageLibCtxEntry* entry) {
+    free(entry);
+}
+
+// findBreaker returns the breaker for a pool key, creating it on first use.
+// Called with libCtxPoolLock held.
+static VoltageBreaker* findBreaker(
     const char* policyURL,
+    const char* policyFilePath,
     const char* trustStorePath,
     const char* cachePath,
-    const char* identity,
-    const char* sharedSecret,
-    const char* format
+    int networkTimeout
 ) {
-    VoltageFPEContext* ctx = (VoltageFPEContext*)malloc(sizeof(VoltageFPEContext));
-    if (!ctx) return NULL;
+    VoltageBreaker* breaker = breakers;
+    while (breaker && !(sameString(breaker->policyURL, policyURL) &&
+                        sameString(breaker->policyFilePath, policyFilePath) &&
+                        sameString(breaker->trustStorePath, trustStorePath) &&
+                        sameString(breaker->cachePath, cachePath) &&
+                        breaker->networkTimeout == networkTimeout)) {
+        breaker = breaker->next;
+    }
+    if (breaker) return breaker;
+
+    breaker = (VoltageBreaker*)calloc(1, sizeof(VoltageBreaker));
+    if (!breaker) return NULL;
+    breaker->policyURL = dupString(policyURL);
+    breaker->policyFilePath = dupString(policyFilePath);
+    breaker->trustStorePath = dupString(trustStorePath);
+    breaker->cachePath = dupString(cachePath);
+    breaker->networkTimeout = networkTimeout;
+    breaker->next = breakers;
+    breakers = breaker;
+    return breaker;
+}
+
+static void unlinkLibCtxEntry(VoltageLibCtxEntry* entry) {
+    VoltageLibCtxEntry** link = &libCtxPool;
+    while (*link && *link != entry) link = &(*link)->next;
+    if (*link) *link = entry->next;
+}
+
+static int isNetworkError(int status) {
+    return status == VE_ERROR_NETWORK_CONNECT || status == VE_ERROR_TIMEOUT;
+}
+
+static int64_t monotonicNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static __thread uint64_t jitterState;
+
+// retryBackoff sleeps before retry attempt (0-based): a uniformly random
+// delay in [d/2, d] with d = baseMs * 2^attempt, capped at 30s, so callers
+// that failed together do not retry together.
+static void retryBackoff(unsigned int baseMs, unsigned int attempt) {
+    uint64_t ms = baseMs ? baseMs : 1;
+    ms = attempt < 15 ? ms << attempt : ms << 15;
+    if (ms > 30000) ms = 30000;
+
+    if (!jitterState) jitterState = (uint64_t)monotonicNs() ^ (uint64_t)pthread_self() ^ 0x9e3779b97f4a7c15ull;
+    jitterState ^= jitterState << 13;
+    jitterState ^= jitterState >> 7;
+    jitterState ^= jitterState << 17;
+
+    uint64_t ns = ms * 1000000;
+    ns = ns / 2 + jitterState % (ns / 2 + 1);
+    struct timespec ts = {(time_t)(ns / 1000000000), (long)(ns % 1000000000)};
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {}
+}
+
+// breakerAllow reports whether a key-server call may go ahead: always while
+// the breaker is closed or disabled (threshold 0), never while it is open,
+// and for a single probe once the cooldown has passed.
+static int breakerAllow(VoltageBreaker* breaker, unsigned int threshold) {
+    if (!threshold) return 1;
+    int64_t until = __atomic_load_n(&breaker->openUntil, __ATOMIC_ACQUIRE);
+    if (until == 0) return 1;
+    if (monotonicNs() < until) return 0;
+
+    int expected = 0;
+    return __atomic_compare_exchange_n(&breaker->probing, &expected, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+static void breakerRecord(VoltageBreaker* breaker, unsigned int threshold, unsigned int cooldownMs, int status) {
+    if (!threshold) return;
+    if (isNetworkError(status)) {
+        if (__atomic_add_fetch(&breaker->failures, 1, __ATOMIC_ACQ_REL) >= threshold) {
+            int64_t until = monotonicNs() + (int64_t)cooldownMs * 1000000;
+            __atomic_store_n(&breaker->openUntil, until, __ATOMIC_RELEASE);
+        }
+    } else if (__atomic_load_n(&breaker->failures, __ATOMIC_ACQUIRE) != 0) {
+        __atomic_store_n(&breaker->failures, 0, __ATOMIC_RELEASE);
+        __atomic_store_n(&breaker->openUntil, 0, __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&breaker->probing, 0, __ATOMIC_RELEASE);
+}
+
+static VoltageLibCtxEntry* acquireLibCtx(const VoltageContextConfig* config, int* status) {
+    // The Simple API takes a policy URL or a policy file, not both; a local
+    // policy snapshot wins.
+    const char* policyFilePath = config->policyFilePath && *config->policyFilePath ? config->policyFilePath : NULL;
+    const char* policyURL = policyFilePath ? NULL : config->policyURL;
+    const char* trustStorePath = config->trustStorePath;
+    const char* cachePath = config->cachePath;
+    int networkTimeout = config->networkTimeout;
+    unsigned int threshold = config->breakerThreshold;
+    unsigned int cooldownMs = config->breakerCooldownMs;
+
+    pthread_mutex_lock(&libCtxPoolLock);
+
+    VoltageBreaker* breaker = findBreaker(policyURL, policyFilePath, trustStorePath, cachePath, networkTimeout);
+    if (!breaker) {
+        pthread_mutex_unlock(&libCtxPoolLock);
+        *status = VE_ERROR_MEMORY;
+        return NULL;
+    }
+
+    VoltageLibCtxEntry* entry = libCtxPool;
+    while (entry && entry->breaker != breaker) entry = entry->next;
+
+    if (entry) {
+        entry->refs++;
+        while (!entry->ready) pthread_cond_wait(&libCtxPoolReady, &libCtxPoolLock);
+        *status = entry->status;
+        if (entry->status != 0) {
+            if (--entry->refs == 0) freeLibCtxEntry(entry);
+            entry = NULL;
+        }
+        pthread_mutex_unlock(&libCtxPoolLock);
+        return entry;
+    }
+
+    if (!breakerAllow(breaker, threshold)) {
+        pthread_mutex_unlock(&libCtxPoolLock);
+        *status = VOLTAGE_ERROR_CIRCUIT_OPEN;
+        return NULL;
+    }
+
+    entry = (VoltageLibCtxEntry*)calloc(1, sizeof(VoltageLibCtxEntry));
+    if (!entry) {
+        __atomic_store_n(&breaker->probing, 0, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&libCtxPoolLock);
+        *status = VE_ERROR_MEMORY;
+        return NULL;
+    }
+    entry->breaker = breaker;
+    entry->refs = 1;
+    entry->next = libCtxPool;
+    libCtxPool = entry;
+    pthread_mutex_unlock(&libCtxPoolLock);
 
     VeLibCtxParams args = VeLibCtxParamsDefaults;
     args.policyURL = policyURL;
+    args.policyFilePath = policyFilePath;
     args.trustStorePath = trustStorePath;
     args.fileCachePath = cachePath;
     args.clientIdProduct = "VoltageCGO";
     args.clientIdProductVersion = "1.0";
+    if (networkTimeout > 0) args.networkTimeout = networkTimeout;
+
+    VeLibCtx libctx = NULL;
+    for (unsigned int attempt = 0;; attempt++) {
+        *status = VeCreateLibCtx(&args, &libctx);
+        breakerRecord(breaker, threshold, cooldownMs, *status);
+        if (*status == 0) break;
+        VeDestroyLibCtx(&libctx);
+        if (!isNetworkError(*status) || attempt >= config->retries) break;
+        retryBackoff(config->retryBackoffMs, attempt);
+        if (!breakerAllow(breaker, threshold)) break;
+    }
+
+    pthread_mutex_lock(&libCtxPoolLock);
+    entry->libctx = libctx;
+    entry->status = *status;
+    entry->ready = 1;
+    if (*status != 0) {
+        unlinkLibCtxEntry(entry);
+        if (--entry->refs == 0) freeLibCtxEntry(entry);
+        entry = NULL;
+    }
+    pthread_cond_broadcast(&libCtxPoolReady);
+    pthread_mutex_unlock(&libCtxPoolLock);
+    return entry;
+}
+
+static void releaseLibCtx(VoltageLibCtxEntry* entry) {
+    if (!entry) return;
+
+    pthread_mutex_lock(&libCtxPoolLock);
+    int last = --entry->refs == 0;
+    if (last) unlinkLibCtxEntry(entry);
+    pthread_mutex_unlock(&libCtxPoolLock);
 
-    int status = VeCreateLibCtx(&args, &ctx->libctx);
-    if (status != 0) return NULL;
+    if (last) {
+        VeDestroyLibCtx(&entry->libctx);
+        freeLibCtxEntry(entry);
+    }
+}
+
+int VoltageSharedLibCtxCount(void) {
+    int count = 0;
+
+    pthread_mutex_lock(&libCtxPoolLock);
+    for (VoltageLibCtxEntry* entry = libCtxPool; entry; entry = entry->next) {
+        if (entry->ready) count++;
+    }
+    pthread_mutex_unlock(&libCtxPoolLock);
+    return count;
+}
+
+enum {
+    VOLTAGE_CLASS_ANY,
+    VOLTAGE_CLASS_DIGITS,
+    VOLTAGE_CLASS_ALNUM,
+    VOLTAGE_CLASS_DATE
+};
+
+// Known formats, matched case-insensitively against the whole policy format
+// name when a format entry is created: name, class, min and max format
+// characters (0 = no limit), the output bound as scale * inputSize + slack,
+// and a sample value used to warm the format up. FPE formats preserve length,
+// so their bound is exact. Any other name is screened for emptiness only and
+// gets the generic VoltageOutputBound: a policy is free to name a format
+// "candidate_name", so the name alone says nothing about what it accepts.
+#define VOLTAGE_FORMATS(X)                                                                 \
+    X(SSN,          "ssn",          VOLTAGE_CLASS_DIGITS, 9,  9,  1, 0, "123456789")        \
+    X(CC,           "cc",           VOLTAGE_CLASS_DIGITS, 12, 19, 1, 0, "4111111111111111") \
+    X(DATE,         "date",         VOLTAGE_CLASS_DATE,   1,  0,  1, 0, "2000-01-01")       \
+    X(ALPHANUMERIC, "alphanumeric", VOLTAGE_CLASS_ALNUM,  2,  0,  1, 0, "WarmUp0123")       \
+    X(NUMERIC,      "numeric",      VOLTAGE_CLASS_DIGITS, 2,  0,  1, 0, "0123456789")       \
+    X(DIGITS,       "digits",       VOLTAGE_CLASS_DIGITS, 2,  0,  1, 0, "0123456789")
+
+struct VoltageFormatDescriptor {
+    const char* name;
+    int inputClass;
+    unsigned int minChars;
+    unsigned int maxChars;
+    unsigned int outputScale;
+    unsigned int outputSlack;
+    const char* sample;
+};
+
+#define VOLTAGE_FORMAT_ID(id, name, inputClass, minChars, maxChars, scale, slack, sample) VOLTAGE_FORMAT_##id,
+#define VOLTAGE_FORMAT_DESCRIPTOR(id, name, inputClass, minChars, maxChars, scale, slack, sample) \
+    [VOLTAGE_FORMAT_##id] = {name, inputClass, minChars, maxChars, scale, slack, sample},
+
+enum {
+    VOLTAGE_FORMATS(VOLTAGE_FORMAT_ID)
+    VOLTAGE_FORMAT_COUNT
+};
+
+static const VoltageFormatDescriptor formatDescriptors[VOLTAGE_FORMAT_COUNT] = {
+    VOLTAGE_FORMATS(VOLTAGE_FORMAT_DESCRIPTOR)
+};
+
+static const VoltageFormatDescriptor genericFormat = {
+    NULL, VOLTAGE_CLASS_ANY, 0, 0, 2, 16, "0123456789"
+};
+
+static const VoltageFormatDescriptor* describeFormat(const char* format) {
+    for (int i = 0; i < VOLTAGE_FORMAT_COUNT; i++) {
+        if (strcasecmp(format, formatDescriptors[i].name) == 0) return &formatDescriptors[i];
+    }
+    return &genericFormat;
+}
+
+
+static void freeFormatEntry(VoltageFormatEntry* entry) {
+    VeDestroyFPE(&entry->fpeProtect);
+    VeDestroyFPE(&entry->fpeAccess);
+    free(entry->format);
+    free(entry);
+}
+
+static VoltageFormatEntry* findFormatEntry(VoltageFormatEntry* entry, const char* format) {
+    while (entry && strcmp(entry->format, format) != 0) entry = entry->next;
+    return entry;
+}
+
+// lookupFormat returns the entry for format, creating it on first use. Entries
+// live as long as the context so readers need no lock; a context holds at most
+// VOLTAGE_MAX_FORMATS of them, after which new names fail with
+// VOLTAGE_ERROR_TOO_MANY_FORMATS. status, if not NULL, receives the reason
+// for a NULL result.
+static VoltageFormatEntry* lookupFormat(VoltageFPEContext* ctx, const char* format, int* status) {
+    if (!format || !*format) return ctx->defaultFormat;
+
+    VoltageFormatEntry* entry = findFormatEntry(__atomic_load_n(&ctx->formats, __ATOMIC_ACQUIRE), format);
+    if (entry) return entry;
+
+    int failure = VE_ERROR_MEMORY;
+    pthread_mutex_lock(&ctx->lock);
+    entry = findFormatEntry(ctx->formats, format);
+    if (!entry && ctx->formatCount >= VOLTAGE_MAX_FORMATS) {
+        failure = VOLTAGE_ERROR_TOO_MANY_FORMATS;
+    } else if (!entry) {
+        entry = (VoltageFormatEntry*)calloc(1, sizeof(VoltageFormatEntry));
+        if (entry) entry->format = strdup(format);
+        if (entry) entry->descriptor = describeFormat(format);
+        if (entry && !entry->format) {
+            free(entry);
+            entry = NULL;
+        }
+        if (entry) {
+            entry->next = ctx->formats;
+            ctx->formatCount++;
+            __atomic_store_n(&ctx->formats, entry, __ATOMIC_RELEASE);
+        }
+    }
+    pthread_mutex_unlock(&ctx->lock);
+    if (!entry && status) *status = failure;
+    return entry;
+}
+
+// isTransientError reports whether a failed VeCreateFPE may succeed when
+// simply tried again; anything else, such as a format the policy does not
+// define, is cached on the format entry and returned without calling the
+// vendor library again.
+static int isTransientError(int status) {
+    return isNetworkError(status) || status == VE_ERROR_MEMORY || status == VE_ERROR_AUTHORIZATION_EXPIRED;
+}
+
+static int materializeFPE(
+    VoltageFPEContext* ctx,
+    VoltageFormatEntry* entry,
+    int direction,
+    VeFPE* out
+) {
+    int which = direction == VOLTAGE_DIRECTION_PROTECT ? 0 : 1;
+    VeFPE* slot = which == 0 ? &entry->fpeProtect : &entry->fpeAccess;
+    VoltageBreaker* breaker = ctx->shared->breaker;
+
+    VeFPE fpe = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+    if (fpe) {
+        *out = fpe;
+        return 0;
+    }
+    int failed = __atomic_load_n(&entry->createStatus[which], __ATOMIC_ACQUIRE);
+    if (failed != 0 && !isTransientError(failed)) return failed;
+
+    // One caller per entry and direction creates the FPE object; the others
+    // wait for its outcome. ctx->lock is only held to claim and publish, never
+    // across VeCreateFPE or a backoff, so other formats and directions, and
+    // new format lookups, are not held up by a slow key server.
+    pthread_mutex_lock(&ctx->lock);
+    int waited = 0;
+    while (!*slot && entry->creating[which]) {
+        pthread_cond_wait(&ctx->materialized, &ctx->lock);
+        waited = 1;
+    }
+    fpe = *slot;
+    if (fpe || waited) {
+        int status = fpe ? 0 : entry->createStatus[which];
+        pthread_mutex_unlock(&ctx->lock);
+        *out = fpe;
+        return status;
+    }
+    if (!breakerAllow(breaker, ctx->breakerThreshold)) {
+        pthread_mutex_unlock(&ctx->lock);
+        return VOLTAGE_ERROR_CIRCUIT_OPEN;
+    }
+    entry->creating[which] = 1;
+    pthread_mutex_unlock(&ctx->lock);
 
     VeFPEParams fpeParams = VeFPEParamsDefaults;
-    fpeParams.protect = 1;
-    fpeParams.identity = identity;
-    fpeParams.sharedSecret = sharedSecret;
-    fpeParams.format = format;
+    fpeParams.protect = direction == VOLTAGE_DIRECTION_PROTECT;
+    fpeParams.access = direction == VOLTAGE_DIRECTION_ACCESS;
+    fpeParams.identity = ctx->identity;
+    fpeParams.sharedSecret = ctx->sharedSecret;
+    fpeParams.format = entry->format;
+
+    int status;
+    for (unsigned int attempt = 0;; attempt++) {
+        status = VeCreateFPE(ctx->libctx, &fpeParams, &fpe);
+        breakerRecord(breaker, ctx->breakerThreshold, ctx->breakerCooldownMs, status);
+        if (status == 0) break;
+        VeDestroyFPE(&fpe);
+        if (!isNetworkError(status) || attempt >= ctx->retries) break;
+        retryBackoff(ctx->retryBackoffMs, attempt);
+        if (!breakerAllow(breaker, ctx->breakerThreshold)) break;
+    }
+
+    pthread_mutex_lock(&ctx->lock);
+    if (status == 0) __atomic_store_n(slot, fpe, __ATOMIC_RELEASE);
+    __atomic_store_n(&entry->createStatus[which], status, __ATOMIC_RELEASE);
+    entry->creating[which] = 0;
+    pthread_cond_broadcast(&ctx->materialized);
+    pthread_mutex_unlock(&ctx->lock);
+
+    *out = fpe;
+    return status;
+}
+
+static int lookupFPE(
+    VoltageFPEContext* ctx,
+    const char* format,
+    int direction,
+    VeFPE* out,
+    const VoltageFormatDescriptor** descriptor
+) {
+    int status;
+    VoltageFormatEntry* entry = lookupFormat(ctx, format, &status);
+    if (descriptor) *descriptor = entry ? entry->descriptor : &genericFormat;
+    if (!entry) return status;
+    return materializeFPE(ctx, entry, direction, out);
+}
+
+int VoltageMaterialize(VoltageFPEContext* ctx, const char* format, int directions) {
+    VeFPE fpe;
+
+    if (!ctx) return VE_ERROR_NULL_ARG;
+    if (directions & VOLTAGE_DIRECTION_PROTECT) {
+        int status = lookupFPE(ctx, format, VOLTAGE_DIRECTION_PROTECT, &fpe, NULL);
+        if (status != 0) return status;
+    }
+    if (directions & VOLTAGE_DIRECTION_ACCESS) {
+        int status = lookupFPE(ctx, format, VOLTAGE_DIRECTION_ACCESS, &fpe, NULL);
+        if (status != 0) return status;
+    }
+    return 0;
+}
+
+int VoltageMaterializedDirections(VoltageFPEContext* ctx, const char* format) {
+    VoltageFormatEntry* entry;
+    int directions = 0;
+
+    if (!ctx) return 0;
+    if (format && *format) {
+        entry = findFormatEntry(__atomic_load_n(&ctx->formats, __ATOMIC_ACQUIRE), format);
+    } else {
+        entry = ctx->defaultFormat;
+    }
+    if (!entry) return 0;
+
+    if (__atomic_load_n(&entry->fpeProtect, __ATOMIC_ACQUIRE)) directions |= VOLTAGE_DIRECTION_PROTECT;
+    if (__atomic_load_n(&entry->fpeAccess, __ATOMIC_ACQUIRE)) directions |= VOLTAGE_DIRECTION_ACCESS;
+    return directions;
+}
+
+// VoltageWarmUp materializes the requested directions of format and runs a
+// throwaway protect and/or access of the format's sample value, so the key
+// fetch happens now rather than on the first real request. A sample the
+// format rejects as user data still counts: the key was needed to get there.
+int VoltageWarmUp(VoltageFPEContext* ctx, const char* format, int directions) {
+    unsigned char ciphertext[64];
+    unsigned char plaintext[64];
+    unsigned int ciphertextLen = 0;
+    unsigned int plaintextLen = 0;
 
-    status = VeCreateFPE(ctx->libctx, &fpeParams, &ctx->fpeProtect);
-    if (status != 0) return NULL;
+    if (!ctx) return VE_ERROR_NULL_ARG;
 
-    fpeParams.protect = 0;
-    fpeParams.access = 1;
+    int status = VoltageMaterialize(ctx, format, directions);
+    if (status != 0) return status;
 
-    status = VeCreateFPE(ctx->libctx, &fpeParams, &ctx->fpeAccess);
-    if (status != 0) return NULL;
+    VoltageFormatEntry* entry = lookupFormat(ctx, format, &status);
+    if (!entry) return status;
+    const unsigned char* sample = (const unsigned char*)entry->descriptor->sample;
+    unsigned int sampleSize = (unsigned int)strlen(entry->descriptor->sample);
 
+    // Ciphertexts keep the format, so without a protect the sample itself
+    // stands in for one.
+    memcpy(ciphertext, sample, sampleSize);
+    ciphertextLen = sampleSize;
+
+    if (directions & VOLTAGE_DIRECTION_PROTECT) {
+        status = VoltageProtectInto(ctx, format, sample, sampleSize, NULL, 0,
+                                    ciphertext, sizeof(ciphertext), &ciphertextLen);
+        if (status != 0 && !VeIsFpeUserDataError(status)) return status;
+        if (status != 0) {
+            memcpy(ciphertext, sample, sampleSize);
+            ciphertextLen = sampleSize;
+        }
+    }
+    if (directions & VOLTAGE_DIRECTION_ACCESS) {
+        status = VoltageAccessInto(ctx, format, ciphertext, ciphertextLen, NULL, 0,
+                                   plaintext, sizeof(plaintext), &plaintextLen);
+        if (status != 0 && !VeIsFpeUserDataError(status)) return status;
+    }
+    return 0;
+}
+
+VoltageFPEContext* CreateVoltageFPEContext(
+    const char* policyURL,
+    const char* trustStorePath,
+    const char* cachePath,
+    const char* identity,
+    const char* sharedSecret,
+    const char* format
+) {
+    VoltageContextConfig config = {
+        .policyURL = policyURL,
+        .trustStorePath = trustStorePath,
+        .cachePath = cachePath,
+        .identity = identity,
+        .sharedSecret = sharedSecret,
+        .format = format,
+    };
+    int status;
+    return CreateVoltageFPEContextWithConfig(&config, &status);
+}
+
+VoltageFPEContext* CreateVoltageFPEContextWithConfig(const VoltageContextConfig* config, int* status) {
+    if (!config || !status) return NULL;
+
+    const char* format = config->format;
+    VoltageFPEContext* ctx = (VoltageFPEContext*)calloc(1, sizeof(VoltageFPEContext));
+    if (!ctx) {
+        *status = VE_ERROR_MEMORY;
+        return NULL;
+    }
+
+    pthread_mutex_init(&ctx->lock, NULL);
+    pthread_cond_init(&ctx->materialized, NULL);
+    ctx->identity = dupString(config->identity);
+    ctx->sharedSecret = dupString(config->sharedSecret);
+    ctx->retries = config->retries;
+    ctx->retryBackoffMs = config->retryBackoffMs;
+    ctx->breakerThreshold = config->breakerThreshold;
+    ctx->breakerCooldownMs = config->breakerCooldownMs;
+
+    ctx->shared = acquireLibCtx(config, status);
+    if (!ctx->shared) {
+        DestroyVoltageFPEContext(ctx);
+        return NULL;
+    }
+    ctx->libctx = ctx->shared->libctx;
+
+    *status = VE_ERROR_NULL_ARG;
+    ctx->defaultFormat = format && *format ? lookupFormat(ctx, format, status) : NULL;
+    if (!ctx->defaultFormat) {
+        DestroyVoltageFPEContext(ctx);
+        return NULL;
+    }
+
+    *status = 0;
     return ctx;
 }
 
-char* VoltageProtect(VoltageFPEContext* ctx, const char* input) {
+typedef struct {
+    unsigned char* data;
+    unsigned int size;
+} VoltageScratch;
+
+static pthread_key_t scratchKey;
+static pthread_once_t scratchOnce = PTHREAD_ONCE_INIT;
+
+static void freeScratch(void* p) {
+    VoltageScratch* scratch = (VoltageScratch*)p;
+    free(scratch->data);
+    free(scratch);
+}
+
+static void createScratchKey(void) {
+    pthread_key_create(&scratchKey, freeScratch);
+}
+
+static VoltageScratch* threadScratch(unsigned int size) {
+    pthread_once(&scratchOnce, createScratchKey);
+
+    VoltageScratch* scratch = (VoltageScratch*)pthread_getspecific(scratchKey);
+    if (!scratch) {
+        scratch = (VoltageScratch*)calloc(1, sizeof(VoltageScratch));
+        if (!scratch) return NULL;
+        pthread_setspecific(scratchKey, scratch);
+    }
+    if (scratch->size < size) {
+        unsigned char* data = (unsigned char*)realloc(scratch->data, size);
+        if (!data) return NULL;
+        scratch->data = data;
+        scratch->size = size;
+    }
+    return scratch;
+}
+
+typedef struct {
+    unsigned int digits;
+    unsigned int letters;
+} VoltageCharCounts;
+
+typedef void (*VoltageCountFn)(const unsigned char* p, size_t n, VoltageCharCounts* counts);
+
+static void countCharsScalar(const unsigned char* p, size_t n, VoltageCharCounts* counts) {
+    for (size_t i = 0; i < n; i++) {
+        counts->digits += (unsigned char)(p[i] - '0') < 10;
+        counts->letters += (unsigned char)((p[i] | 0x20) - 'a') < 26;
+    }
+}
+
+#if defined(__x86_64__)
+// Range checks use the signed-compare trick: adding 0x80 - lo maps [lo, lo+n)
+// onto [-128, -128+n), so one signed compare against -128+n tests the range.
+static void countCharsSSE2(const unsigned char* p, size_t n, VoltageCharCounts* counts) {
+    const __m128i digitBias = _mm_set1_epi8((char)(0x80 - '0'));
+    const __m128i digitLimit = _mm_set1_epi8((char)(0x80 + 10));
+    const __m128i letterBias = _mm_set1_epi8((char)(0x80 - 'a'));
+    const __m128i letterLimit = _mm_set1_epi8((char)(0x80 + 26));
+    const __m128i lower = _mm_set1_epi8(0x20);
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+        __m128i d = _mm_cmplt_epi8(_mm_add_epi8(v, digitBias), digitLimit);
+        __m128i l = _mm_cmplt_epi8(_mm_add_epi8(_mm_or_si128(v, lower), letterBias), letterLimit);
+        counts->digits += __builtin_popcount((unsigned int)_mm_movemask_epi8(d));
+        counts->letters += __builtin_popcount((unsigned int)_mm_movemask_epi8(l));
+    }
+    countCharsScalar(p + i, n - i, counts);
+}
+
+__attribute__((target("avx2")))
+static void countCharsAVX2(const unsigned char* p, size_t n, VoltageCharCounts* counts) {
+    const __m256i digitBias = _mm256_set1_epi8((char)(0x80 - '0'));
+    const __m256i digitLimit = _mm256_set1_epi8((char)(0x80 + 10));
+    const __m256i letterBias = _mm256_set1_epi8((char)(0x80 - 'a'));
+    const __m256i letterLimit = _mm256_set1_epi8((char)(0x80 + 26));
+    const __m256i lower = _mm256_set1_epi8(0x20);
+    size_t i = 0;
+
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(p + i));
+        __m256i d = _mm256_cmpgt_epi8(digitLimit, _mm256_add_epi8(v, digitBias));
+        __m256i l = _mm256_cmpgt_epi8(letterLimit, _mm256_add_epi8(_mm256_or_si256(v, lower), letterBias));
+        counts->digits += __builtin_popcount((unsigned int)_mm256_movemask_epi8(d));
+        counts->letters += __builtin_popcount((unsigned int)_mm256_movemask_epi8(l));
+    }
+    countCharsSSE2(p + i, n - i, counts);
+}
+#endif
+
+static VoltageCountFn countChars = countCharsScalar;
+static pthread_once_t countCharsOnce = PTHREAD_ONCE_INIT;
+
+static void resolveCountChars(void) {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    countChars = __builtin_cpu_supports("avx2") ? countCharsAVX2 : countCharsSSE2;
+#endif
+}
+
+// precheckInput rejects values the vendor library is certain to reject for
+// format d, with the status it would return, so they never reach
+// VeProtect/VeAccess. Anything it is unsure about is let through.
+static int precheckInput(const VoltageFormatDescriptor* d, const unsigned char* input, unsigned int size) {
+    VoltageCharCounts counts = {0, 0};
+    unsigned int chars;
+
+    if (size == 0) return VE_ERROR_FPE_INPUT_LENGTH_ZERO;
+    if (d->inputClass == VOLTAGE_CLASS_ANY) return 0;
+
+    pthread_once(&countCharsOnce, resolveCountChars);
+    countChars(input, size, &counts);
+
+    switch (d->inputClass) {
+    case VOLTAGE_CLASS_DIGITS:
+        if (counts.letters > 0) return VE_ERROR_INPUT_DOES_NOT_MATCH_FORMAT;
+        chars = counts.digits;
+        break;
+    case VOLTAGE_CLASS_ALNUM:
+        chars = counts.digits + counts.letters;
+        break;
+    case VOLTAGE_CLASS_DATE:
+        if (counts.digits == 0) return VE_ERROR_INPUT_DOES_NOT_MATCH_FORMAT;
+        return 0;
+    default:
+        return 0;
+    }
+    if (chars < d->minChars) return VE_ERROR_FPE_INPUT_LENGTH_TOO_SHORT;
+    if (d->maxChars && chars > d->maxChars) return VE_ERROR_INPUT_DOES_NOT_MATCH_FORMAT;
+    return 0;
+}
+
+unsigned int VoltageOutputBound(unsigned int inputSize) {
+    return inputSize * 2 + 16;
+}
+
+int VoltageFormatSizing(VoltageFPEContext* ctx, const char* format, unsigned int* scale, unsigned int* slack) {
+    if (!ctx || !scale || !slack) return VE_ERROR_NULL_ARG;
+
+    int status;
+    VoltageFormatEntry* entry = lookupFormat(ctx, format, &status);
+    if (!entry) return status;
+    *scale = entry->descriptor->outputScale;
+    *slack = entry->descriptor->outputSlack;
+    return 0;
+}
+
+static unsigned int entryOutputBound(VoltageFPEContext* ctx, const char* format, unsigned int inputSize) {
+    VoltageFormatEntry* entry = ctx ? lookupFormat(ctx, format, NULL) : NULL;
+    if (!entry) return VoltageOutputBound(inputSize);
+
+    unsigned int size = entry->descriptor->outputScale * inputSize + entry->descriptor->outputSlack;
+    return size ? size : 1;
+}
+
+int VoltageProtectInto(
+    VoltageFPEContext* ctx,
+    const char* format,
+    const unsigned char* input,
+    unsigned int inputSize,
+    const unsigned char* tweak,
+    unsigned int tweakSize,
+    unsigned char* output,
+    unsigned int outputSize,
+    unsigned int* outputLen
+) {
     VeProtectParams params = VeProtectParamsDefaults;
-    static char ciphertextBuf[300];
+    VeFPE fpe;
+    const VoltageFormatDescriptor* descriptor = &genericFormat;
+
+    if (!ctx || !input || !output || !outputLen) return VE_ERROR_NULL_ARG;
+
+    int status = lookupFPE(ctx, format, VOLTAGE_DIRECTION_PROTECT, &fpe, &descriptor);
+    if (status == 0) status = precheckInput(descriptor, input, inputSize);
+    if (status != 0) return status;
+
+    params.plaintext = input;
+    params.plaintextSize = inputSize;
+    params.tweak = tweak;
+    params.tweakSize = tweak ? tweakSize : 0;
+    params.ciphertext = output;
+    params.ciphertextBufferSize = outputSize;
+
+    status = VeProtect(fpe, &params);
+    if (status != 0) return status;
+
+    *outputLen = params.ciphertextSize;
+    return 0;
+}
+
+static int accessInto(
+    VoltageFPEContext* ctx,
+    const char* format,
+    const unsigned char* input,
+    unsigned int inputSize,
+    const unsigned char* tweak,
+    unsigned int tweakSize,
+    int masked,
+    unsigned char* output,
+    unsigned int outputSize,
+    unsigned int* outputLen
+) {
+    VeAccessParams params = VeAccessParamsDefaults;
+    VeFPE fpe;
+    const VoltageFormatDescriptor* descriptor = &genericFormat;
+
+    if (!ctx || !input || !output || !outputLen) return VE_ERROR_NULL_ARG;
+
+    int status = lookupFPE(ctx, format, VOLTAGE_DIRECTION_ACCESS, &fpe, &descriptor);
+    if (status == 0) status = precheckInput(descriptor, input, inputSize);
+    if (status != 0) return status;
+
+    params.ciphertext = input;
+    params.ciphertextSize = inputSize;
+    params.tweak = tweak;
+    params.tweakSize = tweak ? tweakSize : 0;
+    params.masked = masked;
+    params.plaintext = output;
+    params.plaintextBufferSize = outputSize;
+
+    status = VeAccess(fpe, &params);
+    if (status != 0) return status;
+
+    *outputLen = params.plaintextSize;
+    return 0;
+}
+
+int VoltageAccessInto(
+    VoltageFPEContext* ctx,
+    const char* format,
+    const unsigned char* input,
+    unsigned int inputSize,
+    const unsigned char* tweak,
+    unsigned int tweakSize,
+    unsigned char* output,
+    unsigned int outputSize,
+    unsigned int* outputLen
+) {
+    return accessInto(ctx, format, input, inputSize, tweak, tweakSize, 0, output, outputSize, outputLen);
+}
+
+int VoltageAccessMaskedInto(
+    VoltageFPEContext* ctx,
+    const char* format,
+    const unsigned char* input,
+    unsigned int inputSize,
+    const unsigned char* tweak,
+    unsigned int tweakSize,
+    unsigned char* output,
+    unsigned int outputSize,
+    unsigned int* outputLen
+) {
+    return accessInto(ctx, format, input, inputSize, tweak, tweakSize, 1, output, outputSize, outputLen);
+}
+
+typedef int (*VoltageIntoFn)(
+    VoltageFPEContext*, const char*, const unsigned char*, unsigned int,
+    const unsigned char*, unsigned int, unsigned char*, unsigned int, unsigned int*);
+
+static char* runIntoScratch(
+    VoltageFPEContext* ctx,
+    VoltageIntoFn fn,
+    const char* format,
+    const char* input,
+    const char* tweak
+) {
+    unsigned int inputSize = (unsigned int)strlen(input);
+    unsigned int tweakSize = tweak ? (unsigned int)strlen(tweak) : 0;
+    unsigned int size = entryOutputBound(ctx, format, inputSize);
+
+    for (;;) {
+        VoltageScratch* scratch = threadScratch(size + 1);
+        if (!scratch) return NULL;
+
+        unsigned int len = 0;
+        int status = fn(ctx, format, (const unsigned char*)input, inputSize,
+                        (const unsigned char*)tweak, tweakSize, scratch->data, size, &len);
+        if (status == VE_ERROR_BUFFER_TOO_SMALL && size < VOLTAGE_MAX_OUTPUT_SIZE) {
+            size *= 2;
+            continue;
+        }
+        if (status != 0) return NULL;
+
+        scratch->data[len] = '\0';
+        return strdup((char*)scratch->data);
+    }
+}
+
+static int runIntoMalloc(
+    VoltageFPEContext* ctx,
+    VoltageIntoFn fn,
+    const char* format,
+    const unsigned char* input,
+    unsigned int inputSize,
+    const unsigned char* tweak,
+    unsigned int tweakSize,
+    unsigned char** output,
+    unsigned int* outputLen
+) {
+    unsigned int size = entryOutputBound(ctx, format, inputSize);
+
+    for (;;) {
+        unsigned char* buf = (unsigned char*)malloc(size);
+        if (!buf) return VE_ERROR_MEMORY;
 
-    params.plaintext = (unsigned char*)input;
-    params.plaintextSize = strlen(input);
-    params.ciphertext = (unsigned char*)ciphertextBuf;
-    params.ciphertextBufferSize = 300;
+        int status = fn(ctx, format, input, inputSize, tweak, tweakSize, buf, size, outputLen);
+        if (status == 0) {
+            *output = buf;
+            return 0;
+        }
+        free(buf);
+        if (status != VE_ERROR_BUFFER_TOO_SMALL || size >= VOLTAGE_MAX_OUTPUT_SIZE) return status;
+        size *= 2;
+    }
+}
+
+typedef struct VoltageArenaChunk {
+    struct VoltageArenaChunk* next;
+    size_t mapSize;
+    size_t size;
+    size_t used;
+    unsigned char data[];
+} VoltageArenaChunk;
+
+struct VoltageArena {
+    VoltageArenaChunk* first;
+    VoltageArenaChunk* current;
+    size_t chunkSize;
+    int hugepages;
+};
+
+#define VOLTAGE_HUGEPAGE_SIZE (2u * 1024u * 1024u)
+#define VOLTAGE_ARENA_ALIGN(n) (((n) + 15) & ~(size_t)15)
+
+static VoltageArenaChunk* mapArenaChunk(size_t size, int hugepages) {
+    size_t total = size + sizeof(VoltageArenaChunk);
+    void* p = MAP_FAILED;
+
+    if (hugepages) {
+        total = (total + VOLTAGE_HUGEPAGE_SIZE - 1) & ~(size_t)(VOLTAGE_HUGEPAGE_SIZE - 1);
+        p = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    }
+    if (p == MAP_FAILED) {
+        p = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) return NULL;
+        if (hugepages) madvise(p, total, MADV_HUGEPAGE);
+    }
+
+    VoltageArenaChunk* chunk = (VoltageArenaChunk*)p;
+    chunk->next = NULL;
+    chunk->mapSize = total;
+    chunk->size = total - sizeof(VoltageArenaChunk);
+    chunk->used = 0;
+    return chunk;
+}
+
+VoltageArena* VoltageCreateArena(size_t chunkSize, int hugepages) {
+    VoltageArena* arena = (VoltageArena*)calloc(1, sizeof(VoltageArena));
+    if (!arena) return NULL;
+
+    arena->chunkSize = chunkSize ? chunkSize : VOLTAGE_HUGEPAGE_SIZE;
+    arena->hugepages = hugepages;
+    arena->first = mapArenaChunk(arena->chunkSize, hugepages);
+    if (!arena->first) {
+        free(arena);
+        return NULL;
+    }
+    arena->current = arena->first;
+    return arena;
+}
+
+void* VoltageArenaAlloc(VoltageArena* arena, size_t size) {
+    if (!arena) return NULL;
+    size = VOLTAGE_ARENA_ALIGN(size);
+
+    for (;;) {
+        VoltageArenaChunk* chunk = arena->current;
+        if (chunk->size - chunk->used >= size) {
+            void* p = chunk->data + chunk->used;
+            chunk->used += size;
+            return p;
+        }
+        if (!chunk->next) {
+            chunk->next = mapArenaChunk(size > arena->chunkSize ? size : arena->chunkSize, arena->hugepages);
+            if (!chunk->next) return NULL;
+        }
+        arena->current = chunk->next;
+    }
+}
+
+// Gives back the unused tail of the most recent allocation p.
+static void trimArena(VoltageArena* arena, void* p, size_t used) {
+    VoltageArenaChunk* chunk = arena->current;
+    chunk->used = (size_t)((unsigned char*)p - chunk->data) + VOLTAGE_ARENA_ALIGN(used);
+}
+
+// Regular chunks are kept for reuse; chunks mapped larger than that for a
+// single big allocation are unmapped, so one large result does not stay
+// resident for the life of the arena.
+void VoltageArenaReset(VoltageArena* arena) {
+    if (!arena) return;
+
+    VoltageArenaChunk** link = &arena->first->next;
+    arena->first->used = 0;
+    while (*link) {
+        VoltageArenaChunk* chunk = *link;
+        if (chunk->mapSize > arena->first->mapSize) {
+            *link = chunk->next;
+            munmap(chunk, chunk->mapSize);
+        } else {
+            chunk->used = 0;
+            link = &chunk->next;
+        }
+    }
+    arena->current = arena->first;
+}
+
+void VoltageDestroyArena(VoltageArena* arena) {
+    if (!arena) return;
+    VoltageArenaChunk* chunk = arena->first;
+    while (chunk) {
+        VoltageArenaChunk* next = chunk->next;
+        munmap(chunk, chunk->mapSize);
+        chunk = next;
+    }
+    free(arena);
+}
+
+static const char* runIntoArena(
+    VoltageFPEContext* ctx,
+    VoltageArena* arena,
+    VoltageIntoFn fn,
+    const char* format,
+    const unsigned char* input,
+    unsigned int inputSize,
+    const unsigned char* tweak,
+    unsigned int tweakSize,
+    unsigned int* outputLen,
+    int* status
+) {
+    unsigned int size = entryOutputBound(ctx, format, inputSize);
+
+    if (!arena || !outputLen || !status) return NULL;
+
+    for (;;) {
+        unsigned char* buf = (unsigned char*)VoltageArenaAlloc(arena, (size_t)size + 1);
+        if (!buf) {
+            *status = VE_ERROR_MEMORY;
+            return NULL;
+        }
+
+        *status = fn(ctx, format, input, inputSize, tweak, tweakSize, buf, size, outputLen);
+        if (*status == 0) {
+            buf[*outputLen] = '\0';
+            trimArena(arena, buf, (size_t)*outputLen + 1);
+            return (const char*)buf;
+        }
+        trimArena(arena, buf, 0);
+        if (*status != VE_ERROR_BUFFER_TOO_SMALL || size >= VOLTAGE_MAX_OUTPUT_SIZE) return NULL;
+        size *= 2;
+    }
+}
+
+const char* VoltageProtectArena(
+    VoltageFPEContext* ctx,
+    VoltageArena* arena,
+    const char* format,
+    const unsigned char* input,
+    unsigned int inputSize,
+    const unsigned char* tweak,
+    unsigned int tweakSize,
+    unsigned int* outputLen,
+    int* status
+) {
+    return runIntoArena(ctx, arena, VoltageProtectInto, format, input, inputSize,
+                        tweak, tweakSize, outputLen, status);
+}
+
+const char* VoltageAccessArena(
+    VoltageFPEContext* ctx,
+    VoltageArena* arena,
+    const char* format,
+    const unsigned char* input,
+    unsigned int inputSize,
+    const unsigned char* tweak,
+    unsigned int tweakSize,
+    int masked,
+    unsigned int* outputLen,
+    int* status
+) {
+    return runIntoArena(ctx, arena, masked ? VoltageAccessMaskedInto : VoltageAccessInto, format,
+                        input, inputSize, tweak, tweakSize, outputLen, status);
+}
+
+char* VoltageProtectTweak(
+    VoltageFPEContext* ctx,
+    const char* format,
+    const char* input,
+    const char* tweak
+) {
+    return runIntoScratch(ctx, VoltageProtectInto, format, input, tweak);
+}
+
+char* VoltageAccessTweak(
+    VoltageFPEContext* ctx,
+    const char* format,
+    const char* ciphertext,
+    const char* tweak
+) {
+    return runIntoScratch(ctx, VoltageAccessInto, format, ciphertext, tweak);
+}
+
+char* VoltageAccessMasked(VoltageFPEContext* ctx, const char* format, const char* ciphertext) {
+    return runIntoScratch(ctx, VoltageAccessMaskedInto, format, ciphertext, NULL);
+}
+
+char* VoltageProtectFormat(VoltageFPEContext* ctx, const char* format, const char* input) {
+    return runIntoScratch(ctx, VoltageProtectInto, format, input, NULL);
+}
 
-    int status = VeProtect(ctx->fpeProtect, &params);
-    if (status != 0) return NULL;
+char* VoltageAccessFormat(VoltageFPEContext* ctx, const char* format, const char* ciphertext) {
+    return runIntoScratch(ctx, VoltageAccessInto, format, ciphertext, NULL);
+}
 
-    ciphertextBuf[params.ciphertextSize] = '\0';
-    return strdup((char*)ciphertextBuf);
+char* VoltageProtect(VoltageFPEContext* ctx, const char* input) {
+    return VoltageProtectFormat(ctx, NULL, input);
 }
 
 char* VoltageAccess(VoltageFPEContext* ctx, const char* ciphertext) {
+    return VoltageAccessFormat(ctx, NULL, ciphertext);
+}
+
+// batchShortfall is called once item i of a batch has not fit in the output
+// region, with used bytes taken by the items before it. It runs the rest of
+// the batch through fn into per-thread scratch, only to learn its size, and
+// stores the size the whole batch needs in offsets[count], so the caller can
+// retry once with a region that fits. Items that fail for another reason take
+// no room.
+static int batchShortfall(
+    VoltageFPEContext* ctx,
+    VoltageIntoFn fn,
+    const char* const* formats,
+    const VeConstByteArray* inputs,
+    const VeConstByteArray* tweaks,
+    unsigned int count,
+    unsigned int i,
+    unsigned int used,
+    unsigned int* offsets
+) {
+    uint64_t needed = used;
+
+    for (; i < count; i++) {
+        const char* format = formats ? formats[i] : NULL;
+        const unsigned char* tweak = tweaks ? tweaks[i].ptr : NULL;
+        unsigned int tweakSize = tweak ? tweaks[i].size : 0;
+        unsigned int size = entryOutputBound(ctx, format, inputs[i].size);
+        unsigned int len = 0;
+        int status;
+
+        for (;;) {
+            VoltageScratch* scratch = threadScratch(size);
+            if (!scratch) return VE_ERROR_MEMORY;
+            status = fn(ctx, format, inputs[i].ptr, inputs[i].size, tweak, tweakSize, scratch->data, size, &len);
+            if (status != VE_ERROR_BUFFER_TOO_SMALL || size >= VOLTAGE_MAX_OUTPUT_SIZE) break;
+            size *= 2;
+        }
+        if (status == 0) needed += len;
+    }
+    offsets[count] = needed < UINT_MAX ? (unsigned int)needed : UINT_MAX;
+    return VE_ERROR_BUFFER_TOO_SMALL;
+}
+
+int VoltageProtectBatch(
+    VoltageFPEContext* ctx,
+    const char* const* formats,
+    const VeConstByteArray* inputs,
+    const VeConstByteArray* tweaks,
+    unsigned int count,
+    unsigned char* output,
+    unsigned int outputSize,
+    unsigned int* offsets,
+    int* statuses
+) {
+    VeProtectParams params = VeProtectParamsDefaults;
+    VeFPE fpe = NULL;
+    const char* format = NULL;
+    const VoltageFormatDescriptor* descriptor = &genericFormat;
+    int formatStatus = 0;
+    unsigned int used = 0;
+    unsigned int i;
+
+    if (!ctx || !offsets) return VE_ERROR_NULL_ARG;
+    if (count > 0 && (!inputs || !output)) return VE_ERROR_NULL_ARG;
+
+    // Without statuses the batch stops at the first failure, so screen every
+    // value before spending any crypto on the ones ahead of it.
+    if (!statuses) {
+        VoltageFormatEntry* entry = NULL;
+        for (i = 0; i < count; i++) {
+            int status;
+            if (!entry || (formats && formats[i] != format)) {
+                format = formats ? formats[i] : NULL;
+                entry = lookupFormat(ctx, format, &status);
+                if (!entry) return status;
+            }
+            status = precheckInput(entry->descriptor, inputs[i].ptr, inputs[i].size);
+            if (status != 0) return status;
+        }
+    }
+
+    offsets[0] = 0;
+    for (i = 0; i < count; i++) {
+        if (i == 0 || (formats && formats[i] != format)) {
+            format = formats ? formats[i] : NULL;
+            formatStatus = lookupFPE(ctx, format, VOLTAGE_DIRECTION_PROTECT, &fpe, &descriptor);
+        }
+        int status = formatStatus;
+        if (status == 0 && statuses) status = precheckInput(descriptor, inputs[i].ptr, inputs[i].size);
+
+        params.plaintext = inputs[i].ptr;
+        params.plaintextSize = inputs[i].size;
+        params.tweak = tweaks ? tweaks[i].ptr : NULL;
+        params.tweakSize = tweaks && tweaks[i].ptr ? tweaks[i].size : 0;
+        params.ciphertext = output + used;
+        params.ciphertextBufferSize = outputSize - used;
+
+        if (status == 0) status = VeProtect(fpe, &params);
+        if (status == VE_ERROR_BUFFER_TOO_SMALL) {
+            return batchShortfall(ctx, VoltageProtectInto, formats, inputs, tweaks, count, i, used, offsets);
+        }
+        if (status != 0 && !statuses) return status;
+
+        if (statuses) statuses[i] = status;
+        if (status == 0) used += params.ciphertextSize;
+        offsets[i + 1] = used;
+    }
+    return 0;
+}
+
+static int accessBatch(
+    VoltageFPEContext* ctx,
+    const char* const* formats,
+    const VeConstByteArray* inputs,
+    const VeConstByteArray* tweaks,
+    unsigned int count,
+    unsigned char* output,
+    unsigned int outputSize,
+    unsigned int* offsets,
+    int* statuses,
+    int masked
+) {
     VeAccessParams params = VeAccessParamsDefaults;
-    static char plaintextBuf[300];
+    params.masked = masked;
+    VeFPE fpe = NULL;
+    const char* format = NULL;
+    int formatStatus = 0;
+    const VoltageFormatDescriptor* descriptor = &genericFormat;
+    unsigned int used = 0;
+    unsigned int i;
+
+    if (!ctx || !offsets) return VE_ERROR_NULL_ARG;
+    if (count > 0 && (!inputs || !output || !statuses)) return VE_ERROR_NULL_ARG;
+
+    offsets[0] = 0;
+    for (i = 0; i < count; i++) {
+        if (i == 0 || (formats && formats[i] != format)) {
+            format = formats ? formats[i] : NULL;
+            formatStatus = lookupFPE(ctx, format, VOLTAGE_DIRECTION_ACCESS, &fpe, &descriptor);
+        }
+        int status = formatStatus;
+        if (status == 0) status = precheckInput(descriptor, inputs[i].ptr, inputs[i].size);
+
+        params.ciphertext = inputs[i].ptr;
+        params.ciphertextSize = inputs[i].size;
+        params.tweak = tweaks ? tweaks[i].ptr : NULL;
+        params.tweakSize = tweaks && tweaks[i].ptr ? tweaks[i].size : 0;
+        params.plaintext = output + used;
+        params.plaintextBufferSize = outputSize - used;
+
+        if (status == 0) status = VeAccess(fpe, &params);
+        if (status == VE_ERROR_BUFFER_TOO_SMALL) {
+            VoltageIntoFn fn = masked ? VoltageAccessMaskedInto : VoltageAccessInto;
+            return batchShortfall(ctx, fn, formats, inputs, tweaks, count, i, used, offsets);
+        }
+
+        statuses[i] = status;
+        if (status == 0) used += params.plaintextSize;
+        offsets[i + 1] = used;
+    }
+    return 0;
+}
+
+int VoltageAccessBatch(
+    VoltageFPEContext* ctx,
+    const char* const* formats,
+    const VeConstByteArray* inputs,
+    const VeConstByteArray* tweaks,
+    unsigned int count,
+    unsigned char* output,
+    unsigned int outputSize,
+    unsigned int* offsets,
+    int* statuses
+) {
+    return accessBatch(ctx, formats, inputs, tweaks, count, output, outputSize, offsets, statuses, 0);
+}
+
+int VoltageAccessMaskedBatch(
+    VoltageFPEContext* ctx,
+    const char* const* formats,
+    const VeConstByteArray* inputs,
+    const VeConstByteArray* tweaks,
+    unsigned int count,
+    unsigned char* output,
+    unsigned int outputSize,
+    unsigned int* offsets,
+    int* statuses
+) {
+    return accessBatch(ctx, formats, inputs, tweaks, count, output, outputSize, offsets, statuses, 1);
+}
+
+int VoltageErrorDetails(
+    VoltageFPEContext* ctx,
+    const char* format,
+    int direction,
+    int masked,
+    const unsigned char* input,
+    unsigned int inputSize,
+    const unsigned char* tweak,
+    unsigned int tweakSize,
+    char* details,
+    unsigned int detailsSize
+) {
+    VeFPE fpe = NULL;
+
+    if (!ctx || !input || !details || detailsSize == 0) return VE_ERROR_NULL_ARG;
+    details[0] = '\0';
+
+    // Details are thread-local and only valid until the next vendor call, so
+    // the failed operation is repeated here, without the input screen, and
+    // its details copied out before returning. A failure to get the FPE
+    // object leaves details empty: no vendor call of this operation ran, and
+    // whatever the thread holds belongs to an unrelated one.
+    int status = lookupFPE(ctx, format, direction, &fpe, NULL);
+    if (status != 0) return status;
+
+    unsigned int size = entryOutputBound(ctx, format, inputSize);
+    VoltageScratch* scratch = threadScratch(size);
+    if (!scratch) return VE_ERROR_MEMORY;
+
+    if (direction == VOLTAGE_DIRECTION_PROTECT) {
+        VeProtectParams params = VeProtectParamsDefaults;
+        params.plaintext = input;
+        params.plaintextSize = inputSize;
+        params.tweak = tweak;
+        params.tweakSize = tweak ? tweakSize : 0;
+        params.ciphertext = scratch->data;
+        params.ciphertextBufferSize = size;
+        status = VeProtect(fpe, &params);
+    } else {
+        VeAccessParams params = VeAccessParamsDefaults;
+        params.ciphertext = input;
+        params.ciphertextSize = inputSize;
+        params.tweak = tweak;
+        params.tweakSize = tweak ? tweakSize : 0;
+        params.masked = masked;
+        params.plaintext = scratch->data;
+        params.plaintextBufferSize = size;
+        status = VeAccess(fpe, &params);
+    }
+    if (status != 0) {
+        const char* text = VeGetErrorDetails(fpe);
+        if (text) {
+            strncpy(details, text, detailsSize - 1);
+            details[detailsSize - 1] = '\0';
+        }
+    }
+    return status;
+}
+
+static int dataRanges(
+    VoltageFPEContext* ctx,
+    const char* format,
+    int direction,
+    const VeConstByteArray* inputs,
+    unsigned int count,
+    unsigned char* output,
+    unsigned int slotSize,
+    unsigned int* sizes
+) {
+    VeFPE fpe;
+    VeByteArray local[64];
+    VeByteArray* outputs = local;
+    unsigned int i;
+
+    if (!ctx || !sizes) return VE_ERROR_NULL_ARG;
+    if (count == 0) return 0;
+    if (!inputs || !output) return VE_ERROR_NULL_ARG;
+
+    int status = lookupFPE(ctx, format, direction, &fpe, NULL);
+    if (status != 0) return status;
 
-    params.ciphertext = (unsigned char*)ciphertext;
-    params.ciphertextSize = strlen(ciphertext);
-    params.plaintext = (unsigned char*)plaintextBuf;
-    params.plaintextBufferSize = 300;
+    // Typical series fit on the stack; longer ones use the thread scratch,
+    // which nothing else touches until the vendor call returns.
+    if (count > sizeof(local) / sizeof(local[0])) {
+        if (count > UINT_MAX / sizeof(VeByteArray)) return VE_ERROR_MEMORY;
+        VoltageScratch* scratch = threadScratch(count * sizeof(VeByteArray));
+        if (!scratch) return VE_ERROR_MEMORY;
+        outputs = (VeByteArray*)scratch->data;
+    }
+    for (i = 0; i < count; i++) {
+        outputs[i].ptr = output + (size_t)i * slotSize;
+        outputs[i].size = 0;
+        outputs[i].bufferSize = slotSize;
+    }
 
-    int status = VeAccess(ctx->fpeAccess, &params);
-    if (status != 0) return NULL;
+    if (direction == VOLTAGE_DIRECTION_PROTECT) {
+        VeProtectDataRangesParams params = VeProtectDataRangesParamsDefaults;
+        params.plaintexts = inputs;
+        params.ciphertexts = outputs;
+        params.numElements = count;
+        status = VeProtectDataRanges(fpe, &params);
+    } else {
+        VeAccessDataRangesParams params = VeAccessDataRangesParamsDefaults;
+        params.ciphertexts = inputs;
+        params.plaintexts = outputs;
+        params.numElements = count;
+        status = VeAccessDataRanges(fpe, &params);
+    }
 
-    plaintextBuf[params.plaintextSize] = '\0';
-    return strdup((char*)plaintextBuf);
+    if (status == 0) {
+        for (i = 0; i < count; i++) sizes[i] = outputs[i].size;
+    }
+    return status;
+}
+
+int VoltageProtectDataRanges(
+    VoltageFPEContext* ctx,
+    const char* format,
+    const VeConstByteArray* inputs,
+    unsigned int count,
+    unsigned char* output,
+    unsigned int slotSize,
+    unsigned int* sizes
+) {
+    return dataRanges(ctx, format, VOLTAGE_DIRECTION_PROTECT, inputs, count, output, slotSize, sizes);
+}
+
+int VoltageAccessDataRanges(
+    VoltageFPEContext* ctx,
+    const char* format,
+    const VeConstByteArray* inputs,
+    unsigned int count,
+    unsigned char* output,
+    unsigned int slotSize,
+    unsigned int* sizes
+) {
+    return dataRanges(ctx, format, VOLTAGE_DIRECTION_ACCESS, inputs, count, output, slotSize, sizes);
 }
 
 void DestroyVoltageFPEContext(VoltageFPEContext* ctx) {
     if (!ctx) return;
-    VeDestroyFPE(&ctx->fpeProtect);
-    VeDestroyFPE(&ctx->fpeAccess);
-    VeDestroyLibCtx(&ctx->libctx);
+    while (ctx->formats) {
+        VoltageFormatEntry* entry = ctx->formats;
+        ctx->formats = entry->next;
+        freeFormatEntry(entry);
+    }
+    releaseLibCtx(ctx->shared);
+    pthread_mutex_destroy(&ctx->lock);
+    pthread_cond_destroy(&ctx->materialized);
+    free(ctx->identity);
+    free(ctx->sharedSecret);
     free(ctx);
-}
\ No newline at end of file
+}
+
+typedef struct VoltageJob {
+    VoltageFPEContext* ctx;
+    VoltageIntoFn fn;
+    VoltageCompletionFn callback;
+    void* userData;
+    VoltageCompletion result;
+    const char* format;
+    unsigned int inputSize;
+    struct VoltageJob* next;
+    unsigned char data[];
+} VoltageJob;
+
+struct VoltageWorkerPool {
+    pthread_mutex_t lock;
+    pthread_cond_t jobsReady;
+    pthread_cond_t jobsSpace;
+    pthread_cond_t completionsReady;
+    VoltageJob* jobsHead;
+    VoltageJob* jobsTail;
+    VoltageJob* doneHead;
+    VoltageJob* doneTail;
+    unsigned int queued;
+    unsigned int capacity;
+    int stopping;
+    int threadCount;
+    pthread_t* threads;
+};
+
+static void* runWorker(void* arg) {
+    VoltageWorkerPool* pool = (VoltageWorkerPool*)arg;
+
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        while (!pool->jobsHead && !pool->stopping) pthread_cond_wait(&pool->jobsReady, &pool->lock);
+
+        VoltageJob* job = pool->jobsHead;
+        if (!job) {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        pool->jobsHead = job->next;
+        if (!pool->jobsHead) pool->jobsTail = NULL;
+        pool->queued--;
+        pthread_cond_signal(&pool->jobsSpace);
+        pthread_mutex_unlock(&pool->lock);
+
+        job->result.status = runIntoMalloc(job->ctx, job->fn, job->format, job->data, job->inputSize,
+                                           NULL, 0, &job->result.output, &job->result.outputLen);
+
+        if (job->callback) {
+            job->callback(&job->result, job->userData);
+            free(job->result.output);
+            free(job);
+            continue;
+        }
+
+        job->next = NULL;
+        pthread_mutex_lock(&pool->lock);
+        if (pool->doneTail) {
+            pool->doneTail->next = job;
+        } else {
+            pool->doneHead = job;
+        }
+        pool->doneTail = job;
+        pthread_cond_signal(&pool->completionsReady);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+VoltageWorkerPool* VoltageCreateWorkerPool(int threads, unsigned int queueCapacity) {
+    if (threads <= 0 || queueCapacity == 0) return NULL;
+
+    VoltageWorkerPool* pool = (VoltageWorkerPool*)calloc(1, sizeof(VoltageWorkerPool));
+    if (!pool) return NULL;
+
+    pool->threads = (pthread_t*)calloc((size_t)threads, sizeof(pthread_t));
+    if (!pool->threads) {
+        free(pool);
+        return NULL;
+    }
+    pool->capacity = queueCapacity;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->jobsReady, NULL);
+    pthread_cond_init(&pool->jobsSpace, NULL);
+    pthread_cond_init(&pool->completionsReady, NULL);
+
+    for (; pool->threadCount < threads; pool->threadCount++) {
+        if (pthread_create(&pool->threads[pool->threadCount], NULL, runWorker, pool) != 0) {
+            VoltageDestroyWorkerPool(pool);
+            return NULL;
+        }
+    }
+    return pool;
+}
+
+static int submitJob(
+    VoltageWorkerPool* pool,
+    VoltageFPEContext* ctx,
+    VoltageIntoFn fn,
+    const char* format,
+    const unsigned char* input,
+    unsigned int inputSize,
+    uintptr_t tag,
+    VoltageCompletionFn callback,
+    void* userData
+) {
+    if (!pool || !ctx || !input) return VE_ERROR_NULL_ARG;
+
+    size_t formatSize = format && *format ? strlen(format) + 1 : 0;
+    VoltageJob* job = (VoltageJob*)calloc(1, sizeof(VoltageJob) + inputSize + formatSize);
+    if (!job) return VE_ERROR_MEMORY;
+
+    job->ctx = ctx;
+    job->fn = fn;
+    job->callback = callback;
+    job->userData = userData;
+    job->result.tag = tag;
+    job->inputSize = inputSize;
+    memcpy(job->data, input, inputSize);
+    if (formatSize) {
+        memcpy(job->data + inputSize, format, formatSize);
+        job->format = (const char*)(job->data + inputSize);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->queued >= pool->capacity && !pool->stopping) pthread_cond_wait(&pool->jobsSpace, &pool->lock);
+    if (pool->stopping) {
+        pthread_mutex_unlock(&pool->lock);
+        free(job);
+        return VOLTAGE_ERROR_POOL_CLOSED;
+    }
+    if (pool->jobsTail) {
+        pool->jobsTail->next = job;
+    } else {
+        pool->jobsHead = job;
+    }
+    pool->jobsTail = job;
+    pool->queued++;
+    pthread_cond_signal(&pool->jobsReady);
+    pthread_mutex_unlock(&pool->lock);
+    return 0;
+}
+
+int VoltageSubmitProtect(
+    VoltageWorkerPool* pool,
+    VoltageFPEContext* ctx,
+    const char* format,
+    const unsigned char* input,
+    unsigned int inputSize,
+    uintptr_t tag,
+    VoltageCompletionFn callback,
+    void* userData
+) {
+    return submitJob(pool, ctx, VoltageProtectInto, format, input, inputSize, tag, callback, userData);
+}
+
+int VoltageSubmitAccess(
+    VoltageWorkerPool* pool,
+    VoltageFPEContext* ctx,
+    const char* format,
+    const unsigned char* input,
+    unsigned int inputSize,
+    uintptr_t tag,
+    VoltageCompletionFn callback,
+    void* userData
+) {
+    return submitJob(pool, ctx, VoltageAccessInto, format, input, inputSize, tag, callback, userData);
+}
+
+unsigned int VoltagePollCompletions(
+    VoltageWorkerPool* pool,
+    VoltageCompletion* completions,
+    unsigned int max,
+    int timeoutMs
+) {
+    unsigned int n = 0;
+
+    if (!pool || !completions || max == 0) return 0;
+
+    pthread_mutex_lock(&pool->lock);
+    if (!pool->doneHead && timeoutMs > 0) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += timeoutMs / 1000;
+        deadline.tv_nsec += (long)(timeoutMs % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        while (!pool->doneHead) {
+            if (pthread_cond_timedwait(&pool->completionsReady, &pool->lock, &deadline) == ETIMEDOUT) break;
+        }
+    }
+    while (pool->doneHead && n < max) {
+        VoltageJob* job = pool->doneHead;
+        pool->doneHead = job->next;
+        if (!pool->doneHead) pool->doneTail = NULL;
+        completions[n++] = job->result;
+        free(job);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return n;
+}
+
+void VoltageReleaseCompletions(VoltageCompletion* completions, unsigned int count) {
+    unsigned int i;
+
+    if (!completions) return;
+    for (i = 0; i < count; i++) {
+        free(completions[i].output);
+        completions[i].output = NULL;
+    }
+}
+
+void VoltageDestroyWorkerPool(VoltageWorkerPool* pool) {
+    int i;
+
+    if (!pool) return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->jobsReady);
+    pthread_cond_broadcast(&pool->jobsSpace);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (i = 0; i < pool->threadCount; i++) pthread_join(pool->threads[i], NULL);
+
+    while (pool->doneHead) {
+        VoltageJob* job = pool->doneHead;
+        pool->doneHead = job->next;
+        free(job->result.output);
+        free(job);
+    }
+    pthread_cond_destroy(&pool->completionsReady);
+    pthread_cond_destroy(&pool->jobsSpace);
+    pthread_cond_destroy(&pool->jobsReady);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->threads);
+    free(pool);
+}
+
+static inline void cpuRelax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+static int initRingQueue(VoltageRingQueue* q, uint32_t capacity) {
+    uint32_t i;
+
+    if (posix_memalign((void**)&q->slots, 64, (size_t)capacity * sizeof(VoltageRingSlot)) != 0) {
+        q->slots = NULL;
+        return VE_ERROR_MEMORY;
+    }
+    for (i = 0; i < capacity; i++) q->slots[i].sequence = i;
+    q->head = 0;
+    q->tail = 0;
+    q->mask = capacity - 1;
+    return 0;
+}
+
+static int ringTryPop(VoltageRingQueue* q, VoltageRingSlot* out) {
+    uint64_t pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+
+    for (;;) {
+        VoltageRingSlot* slot = &q->slots[pos & q->mask];
+        uint64_t seq = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        int64_t dif = (int64_t)(seq - (pos + 1));
+
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&q->tail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                uint32_t size = slot->size < VOLTAGE_RING_SLOT_DATA ? slot->size : VOLTAGE_RING_SLOT_DATA;
+                memcpy(out, slot, offsetof(VoltageRingSlot, data) + size);
+                out->size = size;
+                __atomic_store_n(&slot->sequence, pos + q->mask + 1, __ATOMIC_RELEASE);
+                return 1;
+            }
+        } else if (dif < 0) {
+            return 0;
+        } else {
+            pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static int ringTryPush(VoltageRingQueue* q, const VoltageRingSlot* in) {
+    uint64_t pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+
+    for (;;) {
+        VoltageRingSlot* slot = &q->slots[pos & q->mask];
+        uint64_t seq = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        int64_t dif = (int64_t)(seq - pos);
+
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&q->head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                slot->tag = in->tag;
+                slot->op = in->op;
+                slot->status = in->status;
+                slot->size = in->size;
+                memcpy(slot->data, in->data, in->size);
+                __atomic_store_n(&slot->sequence, pos + 1, __ATOMIC_RELEASE);
+                return 1;
+            }
+        } else if (dif < 0) {
+            return 0;
+        } else {
+            pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static void futexWait(uint32_t* addr, uint32_t value, long timeoutNs) {
+    struct timespec timeout = { 0, timeoutNs };
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, value, &timeout, NULL, 0);
+}
+
+static void futexWake(uint32_t* addr) {
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+static void ringSignal(uint32_t* signal, uint32_t* sleepers) {
+    if (__atomic_load_n(sleepers, __ATOMIC_SEQ_CST) == 0) return;
+    __atomic_add_fetch(signal, 1, __ATOMIC_SEQ_CST);
+    futexWake(signal);
+}
+
+static void* runRingWorker(void* arg) {
+    VoltageRing* ring = (VoltageRing*)arg;
+    VoltageRingSlot* request = (VoltageRingSlot*)malloc(sizeof(VoltageRingSlot));
+    VoltageRingSlot* completion = (VoltageRingSlot*)malloc(sizeof(VoltageRingSlot));
+    unsigned int spinBudget = VOLTAGE_RING_MIN_SPIN;
+
+    if (!request || !completion) {
+        free(request);
+        free(completion);
+        return NULL;
+    }
+
+    while (!__atomic_load_n(&ring->stopping, __ATOMIC_ACQUIRE)) {
+        unsigned int spins = 0;
+        int found = 0;
+
+        while (!(found = ringTryPop(&ring->requests, request)) && spins < spinBudget) {
+            cpuRelax();
+            spins++;
+        }
+
+        if (!found) {
+            spinBudget = spinBudget / 2 > VOLTAGE_RING_MIN_SPIN ? spinBudget / 2 : VOLTAGE_RING_MIN_SPIN;
+
+            __atomic_add_fetch(&ring->requestSleepers, 1, __ATOMIC_SEQ_CST);
+            uint32_t signal = __atomic_load_n(&ring->requestSignal, __ATOMIC_SEQ_CST);
+            found = ringTryPop(&ring->requests, request);
+            if (!found && !__atomic_load_n(&ring->stopping, __ATOMIC_ACQUIRE)) {
+                futexWait(&ring->requestSignal, signal, VOLTAGE_RING_SLEEP_NS);
+            }
+            __atomic_sub_fetch(&ring->requestSleepers, 1, __ATOMIC_SEQ_CST);
+            if (!found) continue;
+        } else if (spins < spinBudget / 2 && spinBudget < VOLTAGE_RING_MAX_SPIN) {
+            spinBudget *= 2;
+        }
+
+        unsigned int outputLen = 0;
+        VoltageIntoFn fn = request->op == VOLTAGE_DIRECTION_PROTECT ? VoltageProtectInto : VoltageAccessInto;
+
+        completion->tag = request->tag;
+        completion->op = request->op;
+        completion->status = fn(ring->ctx, NULL, request->data, request->size, NULL, 0,
+                                completion->data, VOLTAGE_RING_SLOT_DATA, &outputLen);
+        completion->size = completion->status == 0 ? outputLen : 0;
+
+        while (!ringTryPush(&ring->completions, completion)) sched_yield();
+        ringSignal(&ring->completionSignal, &ring->completionSleepers);
+    }
+
+    free(request);
+    free(completion);
+    return NULL;
+}
+
+VoltageRing* VoltageCreateRing(VoltageFPEContext* ctx, int threads, unsigned int capacity, int firstCpu) {
+    if (!ctx || threads <= 0 || capacity < 2 || (capacity & (capacity - 1)) != 0) return NULL;
+
+    VoltageRing* ring = NULL;
+    if (posix_memalign((void**)&ring, 64, sizeof(VoltageRing)) != 0) return NULL;
+    memset(ring, 0, sizeof(VoltageRing));
+
+    ring->ctx = ctx;
+    ring->threads = (pthread_t*)calloc((size_t)threads, sizeof(pthread_t));
+    if (!ring->threads ||
+        initRingQueue(&ring->requests, capacity) != 0 ||
+        initRingQueue(&ring->completions, capacity) != 0) {
+        VoltageDestroyRing(ring);
+        return NULL;
+    }
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    for (; ring->threadCount < threads; ring->threadCount++) {
+        pthread_t* thread = &ring->threads[ring->threadCount];
+        if (pthread_create(thread, NULL, runRingWorker, ring) != 0) {
+            VoltageDestroyRing(ring);
+            return NULL;
+        }
+        if (firstCpu >= 0 && cpus > 0) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET((firstCpu + ring->threadCount) % cpus, &set);
+            pthread_setaffinity_np(*thread, sizeof(set), &set);
+        }
+    }
+    return ring;
+}
+
+void VoltageDestroyRing(VoltageRing* ring) {
+    int i;
+
+    if (!ring) return;
+
+    __atomic_store_n(&ring->stopping, 1, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&ring->requestSignal, 1, __ATOMIC_SEQ_CST);
+    syscall(SYS_futex, &ring->requestSignal, FUTEX_WAKE_PRIVATE, ring->threadCount, NULL, NULL, 0);
+    for (i = 0; i < ring->threadCount; i++) pthread_join(ring->threads[i], NULL);
+    free(ring->requests.slots);
+    free(ring->completions.slots);
+    free(ring->threads);
+    free(ring);
+}
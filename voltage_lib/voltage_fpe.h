@@ -1,15 +1,79 @@
 #ifndef VOLTAGE_FPE_H
 #define VOLTAGE_FPE_H
 
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
 #include "veapi.h"
 #include "vefpe.h"
 
-typedef struct {
-    VeLibCtx libctx;
+#define VOLTAGE_MAX_OUTPUT_SIZE (64u * 1024u * 1024u)
+#define VOLTAGE_MAX_BATCH_OUTPUT_SIZE (1u << 31)
+
+#define VOLTAGE_DIRECTION_PROTECT 1
+#define VOLTAGE_DIRECTION_ACCESS  2
+
+#define VOLTAGE_ERROR_POOL_CLOSED (-1)
+#define VOLTAGE_ERROR_CIRCUIT_OPEN (-2)
+#define VOLTAGE_ERROR_TOO_MANY_FORMATS (-3)
+
+// VOLTAGE_MAX_FORMATS bounds the distinct format names one context tracks.
+#define VOLTAGE_MAX_FORMATS 1024
+
+typedef struct VoltageLibCtxEntry VoltageLibCtxEntry;
+
+typedef struct VoltageFormatDescriptor VoltageFormatDescriptor;
+
+typedef struct VoltageFormatEntry {
+    char* format;
+    const VoltageFormatDescriptor* descriptor;
     VeFPE fpeProtect;
     VeFPE fpeAccess;
+    int creating[2];
+    int createStatus[2];
+    struct VoltageFormatEntry* next;
+} VoltageFormatEntry;
+
+typedef struct {
+    VoltageLibCtxEntry* shared;
+    VeLibCtx libctx;
+    char* identity;
+    char* sharedSecret;
+    VoltageFormatEntry* defaultFormat;
+    VoltageFormatEntry* formats;
+    unsigned int formatCount;
+    pthread_mutex_t lock;
+    pthread_cond_t materialized;
+    unsigned int retries;
+    unsigned int retryBackoffMs;
+    unsigned int breakerThreshold;
+    unsigned int breakerCooldownMs;
 } VoltageFPEContext;
 
+// VoltageContextConfig describes a context. Set policyFilePath to start from
+// a local copy of the client policy instead of downloading it from policyURL.
+// networkTimeout (seconds, 0 = vendor default) bounds each key-server call;
+// calls failing with VE_ERROR_NETWORK_CONNECT or VE_ERROR_TIMEOUT are retried
+// up to retries times with jittered exponential backoff from retryBackoffMs.
+// After breakerThreshold consecutive network failures (0 = never) creating
+// FPE objects on the library context fails fast with
+// VOLTAGE_ERROR_CIRCUIT_OPEN for breakerCooldownMs, then one probe is let
+// through.
+typedef struct {
+    const char* policyURL;
+    const char* policyFilePath;
+    const char* trustStorePath;
+    const char* cachePath;
+    const char* identity;
+    const char* sharedSecret;
+    const char* format;
+    int networkTimeout;
+    unsigned int retries;
+    unsigned int retryBackoffMs;
+    unsigned int breakerThreshold;
+    unsigned int breakerCooldownMs;
+} VoltageContextConfig;
+
 VoltageFPEContext* CreateVoltageFPEContext(
     const char* policyURL,
     const char* trustStorePath,
@@ -18,9 +82,276 @@ VoltageFPEContext* CreateVoltageFPEContext(
     const char* sharedSecret,
     const char* format
 );
+VoltageFPEContext* CreateVoltageFPEContextWithConfig(const VoltageContextConfig* config, int* status);
 
+int VoltageSharedLibCtxCount(void);
+
+int VoltageMaterialize(VoltageFPEContext* ctx, const char* format, int directions);
+int VoltageMaterializedDirections(VoltageFPEContext* ctx, const char* format);
+int VoltageWarmUp(VoltageFPEContext* ctx, const char* format, int directions);
+
+unsigned int VoltageOutputBound(unsigned int inputSize);
+int VoltageFormatSizing(VoltageFPEContext* ctx, const char* format, unsigned int* scale, unsigned int* slack);
+
+int VoltageProtectInto(
+    VoltageFPEContext* ctx,
+    const char* format,
+    const unsigned char* input,
+    unsigned int inputSize,
+    const unsigned char* tweak,
+    unsigned int tweakSize,
+    unsigned char* output,
+    unsigned int outputSize,
+    unsigned int* outputLen
+);
+
+int VoltageAccessInto(
+    VoltageFPEContext* ctx,
+    const char* format,
+    const unsigned char* input,
+    unsigned int inputSize,
+    const unsigned char* tweak,
+    unsigned int tweakSize,
+    unsigned char* output,
+    unsigned int outputSize,
+    unsigned int* outputLen
+);
+
+int VoltageAccessMaskedInto(
+    VoltageFPEContext* ctx,
+    const char* format,
+    const unsigned char* input,
+    unsigned int inputSize,
+    const unsigned char* tweak,
+    unsigned int tweakSize,
+    unsigned char* output,
+    unsigned int outputSize,
+    unsigned int* outputLen
+);
+
+typedef struct VoltageArena VoltageArena;
+
+VoltageArena* VoltageCreateArena(size_t chunkSize, int hugepages);
+void* VoltageArenaAlloc(VoltageArena* arena, size_t size);
+void VoltageArenaReset(VoltageArena* arena);
+void VoltageDestroyArena(VoltageArena* arena);
+
+// Results are NUL-terminated and live in the arena until its next reset.
+const char* VoltageProtectArena(
+    VoltageFPEContext* ctx,
+    VoltageArena* arena,
+    const char* format,
+    const unsigned char* input,
+    unsigned int inputSize,
+    const unsigned char* tweak,
+    unsigned int tweakSize,
+    unsigned int* outputLen,
+    int* status
+);
+
+const char* VoltageAccessArena(
+    VoltageFPEContext* ctx,
+    VoltageArena* arena,
+    const char* format,
+    const unsigned char* input,
+    unsigned int inputSize,
+    const unsigned char* tweak,
+    unsigned int tweakSize,
+    int masked,
+    unsigned int* outputLen,
+    int* status
+);
+
+char* VoltageProtectTweak(
+    VoltageFPEContext* ctx,
+    const char* format,
+    const char* input,
+    const char* tweak
+);
+
+char* VoltageAccessTweak(
+    VoltageFPEContext* ctx,
+    const char* format,
+    const char* ciphertext,
+    const char* tweak
+);
+
+char* VoltageProtectFormat(VoltageFPEContext* ctx, const char* format, const char* input);
+char* VoltageAccessFormat(VoltageFPEContext* ctx, const char* format, const char* ciphertext);
+char* VoltageAccessMasked(VoltageFPEContext* ctx, const char* format, const char* ciphertext);
 char* VoltageProtect(VoltageFPEContext* ctx, const char* input);
 char* VoltageAccess(VoltageFPEContext* ctx, const char* ciphertext);
+
+// The batch calls write the results back to back into output and their
+// boundaries into offsets[0..count]. When output is too small they return
+// VE_ERROR_BUFFER_TOO_SMALL with offsets[count] set to the size the whole
+// batch needs, so one retry with that much room succeeds.
+int VoltageProtectBatch(
+    VoltageFPEContext* ctx,
+    const char* const* formats,
+    const VeConstByteArray* inputs,
+    const VeConstByteArray* tweaks,
+    unsigned int count,
+    unsigned char* output,
+    unsigned int outputSize,
+    unsigned int* offsets,
+    int* statuses
+);
+
+int VoltageAccessBatch(
+    VoltageFPEContext* ctx,
+    const char* const* formats,
+    const VeConstByteArray* inputs,
+    const VeConstByteArray* tweaks,
+    unsigned int count,
+    unsigned char* output,
+    unsigned int outputSize,
+    unsigned int* offsets,
+    int* statuses
+);
+
+int VoltageAccessMaskedBatch(
+    VoltageFPEContext* ctx,
+    const char* const* formats,
+    const VeConstByteArray* inputs,
+    const VeConstByteArray* tweaks,
+    unsigned int count,
+    unsigned char* output,
+    unsigned int outputSize,
+    unsigned int* offsets,
+    int* statuses
+);
+
+// VoltageErrorDetails repeats a failed protect or access of input (direction
+// is one VOLTAGE_DIRECTION_*) and copies the vendor's error details for it
+// into details, NUL-terminated and truncated to detailsSize. It returns the
+// status of the repeat. When the FPE object cannot be obtained (circuit open,
+// too many formats, a cached or fresh creation failure) nothing is repeated,
+// details is left empty and that status is returned.
+int VoltageErrorDetails(
+    VoltageFPEContext* ctx,
+    const char* format,
+    int direction,
+    int masked,
+    const unsigned char* input,
+    unsigned int inputSize,
+    const unsigned char* tweak,
+    unsigned int tweakSize,
+    char* details,
+    unsigned int detailsSize
+);
+
+// The output region holds count slots of slotSize bytes each, because the
+// vendor data-range calls require every output buffer to have the same size.
+int VoltageProtectDataRanges(
+    VoltageFPEContext* ctx,
+    const char* format,
+    const VeConstByteArray* inputs,
+    unsigned int count,
+    unsigned char* output,
+    unsigned int slotSize,
+    unsigned int* sizes
+);
+
+int VoltageAccessDataRanges(
+    VoltageFPEContext* ctx,
+    const char* format,
+    const VeConstByteArray* inputs,
+    unsigned int count,
+    unsigned char* output,
+    unsigned int slotSize,
+    unsigned int* sizes
+);
+
 void DestroyVoltageFPEContext(VoltageFPEContext* ctx);
 
+typedef struct VoltageWorkerPool VoltageWorkerPool;
+
+typedef struct {
+    uintptr_t tag;
+    int status;
+    unsigned char* output;
+    unsigned int outputLen;
+} VoltageCompletion;
+
+// Called on a pool thread; completion->output is freed once it returns.
+typedef void (*VoltageCompletionFn)(const VoltageCompletion* completion, void* userData);
+
+VoltageWorkerPool* VoltageCreateWorkerPool(int threads, unsigned int queueCapacity);
+
+int VoltageSubmitProtect(
+    VoltageWorkerPool* pool,
+    VoltageFPEContext* ctx,
+    const char* format,
+    const unsigned char* input,
+    unsigned int inputSize,
+    uintptr_t tag,
+    VoltageCompletionFn callback,
+    void* userData
+);
+
+int VoltageSubmitAccess(
+    VoltageWorkerPool* pool,
+    VoltageFPEContext* ctx,
+    const char* format,
+    const unsigned char* input,
+    unsigned int inputSize,
+    uintptr_t tag,
+    VoltageCompletionFn callback,
+    void* userData
+);
+
+unsigned int VoltagePollCompletions(
+    VoltageWorkerPool* pool,
+    VoltageCompletion* completions,
+    unsigned int max,
+    int timeoutMs
+);
+
+void VoltageReleaseCompletions(VoltageCompletion* completions, unsigned int count);
+void VoltageDestroyWorkerPool(VoltageWorkerPool* pool);
+
+#define VOLTAGE_RING_SLOT_DATA 512
+#define VOLTAGE_RING_MIN_SPIN  64
+#define VOLTAGE_RING_MAX_SPIN  16384
+#define VOLTAGE_RING_SLEEP_NS  10000000L
+
+typedef struct {
+    uint64_t sequence;
+    uint64_t tag;
+    int op;
+    int status;
+    uint32_t size;
+    uint32_t reserved;
+    unsigned char data[VOLTAGE_RING_SLOT_DATA];
+} VoltageRingSlot;
+
+typedef struct {
+    uint64_t head;
+    char pad0[56];
+    uint64_t tail;
+    char pad1[56];
+    uint64_t mask;
+    VoltageRingSlot* slots;
+} VoltageRingQueue;
+
+// Requests are pushed by Go without a cgo call and popped by the ring's
+// worker threads; completions flow back the other way. The signal words are
+// futexes, bumped only while the matching sleepers count is non-zero.
+typedef struct {
+    VoltageRingQueue requests;
+    VoltageRingQueue completions;
+    uint32_t requestSignal;
+    uint32_t requestSleepers;
+    uint32_t completionSignal;
+    uint32_t completionSleepers;
+    int stopping;
+    int threadCount;
+    VoltageFPEContext* ctx;
+    pthread_t* threads;
+} VoltageRing;
+
+VoltageRing* VoltageCreateRing(VoltageFPEContext* ctx, int threads, unsigned int capacity, int firstCpu);
+void VoltageDestroyRing(VoltageRing* ring);
+
 #endif // VOLTAGE_FPE_H
\ No newline at end of file
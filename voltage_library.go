@@ -3,90 +3,884 @@ package main
 /*
 #cgo CFLAGS: -I./voltage_lib
 #cgo LDFLAGS: -L./voltage_lib -lvoltagefpe -lvibesimpledyn -lpthread -Wl,-rpath=./voltage_lib
+#include <stdlib.h>
 #include "voltage_fpe.h"
 */
 import "C"
 import (
 	"fmt"
+	"runtime"
 	"sync"
+	"sync/atomic"
+	"time"
+	"unsafe"
 )
 
 type VoltageFPE struct {
-	ctx *C.VoltageFPEContext
+	ctx       *C.VoltageFPEContext
+	pending   sync.WaitGroup
+	ring      atomic.Pointer[RingDispatcher]
+	coalescer atomic.Pointer[Coalescer]
+	formats   sync.Map
+	sizing    sync.Map
+	cached    atomic.Int64
+
+	config       ContextConfig
+	fromSnapshot bool
+	onExpired    atomic.Pointer[func()]
+	expired      atomic.Bool
 }
 
-var (
-	fpeStore     = make(map[string]*VoltageFPE)
-	fpeStoreLock sync.RWMutex
+// NewVoltageFPE panics when the context cannot be created; it is kept for
+// existing callers. Use NewVoltageFPEWithConfig to handle the error.
+func NewVoltageFPE(policyURL, trustPath, cachePath, identity, secret, format string) *VoltageFPE {
+	fpe, err := createVoltageFPE(policyURL, trustPath, cachePath, identity, secret, format)
+	if err != nil {
+		panic(err.Error())
+	}
+	return fpe
+}
+
+func createVoltageFPE(policyURL, trustPath, cachePath, identity, secret, format string) (*VoltageFPE, error) {
+	return newVoltageFPEFromConfig(ContextConfig{
+		PolicyURL:      policyURL,
+		TrustStorePath: trustPath,
+		CachePath:      cachePath,
+		Identity:       identity,
+		SharedSecret:   secret,
+		Format:         format,
+
+		NetworkTimeout:   defaultNetworkTimeout,
+		Retries:          defaultRetries,
+		RetryBackoff:     defaultRetryBackoff,
+		BreakerThreshold: defaultBreakerThreshold,
+		BreakerCooldown:  defaultBreakerCooldown,
+	})
+}
+
+const (
+	defaultNetworkTimeout   = 10 * time.Second
+	defaultRetries          = 3
+	defaultRetryBackoff     = 100 * time.Millisecond
+	defaultBreakerThreshold = 5
+	defaultBreakerCooldown  = 30 * time.Second
 )
 
-func NewVoltageFPE(policyURL, trustPath, cachePath, identity, secret, format string) *VoltageFPE {
-	cCtx := C.CreateVoltageFPEContext(
-		C.CString(policyURL),
-		C.CString(trustPath),
-		C.CString(cachePath),
-		C.CString(identity),
-		C.CString(secret),
-		C.CString(format),
-	)
-	if cCtx == nil {
-		panic("failed to init Voltage FPE context")
+const arenaChunkSize = 64 * 1024
+
+// Single-value calls format their result into a pooled C arena instead of a
+// strdup'd buffer. The Go copy is taken before the arena goes back to the
+// pool, so it is reset on every return; the reset also unmaps any oversize
+// chunk a large result needed, so a pooled arena holds one regular chunk.
+var arenaPool = make(chan *C.VoltageArena, 64)
+
+func getArena() *C.VoltageArena {
+	select {
+	case a := <-arenaPool:
+		return a
+	default:
+		return C.VoltageCreateArena(arenaChunkSize, 0)
+	}
+}
+
+func putArena(a *C.VoltageArena) {
+	C.VoltageArenaReset(a)
+	select {
+	case arenaPool <- a:
+	default:
+		C.VoltageDestroyArena(a)
+	}
+}
+
+// cFormat returns a C copy of format; "" selects the default format. Copies
+// of the first VOLTAGE_MAX_FORMATS names live as long as the context, so
+// per-format calls do not allocate. Past that, as the shim refuses new names
+// anyway, each call gets a copy of its own and owned tells the caller to
+// free it.
+func (v *VoltageFPE) cFormat(format string) (name *C.char, owned bool) {
+	if format == "" {
+		return nil, false
+	}
+	if name, ok := v.formats.Load(format); ok {
+		return name.(*C.char), false
+	}
+	cName := C.CString(format)
+	if v.cached.Add(1) > C.VOLTAGE_MAX_FORMATS {
+		v.cached.Add(-1)
+		return cName, true
+	}
+	cached, loaded := v.formats.LoadOrStore(format, cName)
+	if loaded {
+		v.cached.Add(-1)
+		C.free(unsafe.Pointer(cName))
+	}
+	return cached.(*C.char), false
+}
+
+func (v *VoltageFPE) single(protect bool, format, data, tweak string, masked bool) (string, int) {
+	a := getArena()
+	if a == nil {
+		return "", C.VE_ERROR_MEMORY
+	}
+	defer putArena(a)
+
+	input, inputSize := cInput(data)
+	var cTweak *C.uchar
+	var tweakSize C.uint
+	if tweak != "" {
+		cTweak, tweakSize = cInput(tweak)
+	}
+
+	name, owned := v.cFormat(format)
+	if owned {
+		defer C.free(unsafe.Pointer(name))
+	}
+	var outLen C.uint
+	var status C.int
+	var out *C.char
+	if protect {
+		out = C.VoltageProtectArena(v.ctx, a, name, input, inputSize, cTweak, tweakSize, &outLen, &status)
+	} else {
+		var cMasked C.int
+		if masked {
+			cMasked = 1
+		}
+		out = C.VoltageAccessArena(v.ctx, a, name, input, inputSize, cTweak, tweakSize, cMasked, &outLen, &status)
 	}
-	return &VoltageFPE{ctx: cCtx}
+	if out == nil {
+		v.noteStatus(Status(status))
+		return "", int(status)
+	}
+	return C.GoStringN(out, C.int(outLen)), 0
+}
+
+// call runs one default-format operation through the coalescer or ring when
+// enabled, and directly otherwise.
+func (v *VoltageFPE) call(protect bool, data string) (string, Status) {
+	if c := v.coalescer.Load(); c != nil {
+		if value, status, ok := c.do(protect, data); ok {
+			return value, status
+		}
+	}
+	direction := C.int(C.VOLTAGE_DIRECTION_ACCESS)
+	if protect {
+		direction = C.VOLTAGE_DIRECTION_PROTECT
+	}
+	if r := v.ring.Load(); r != nil {
+		if value, status, err := r.do(direction, data); err == nil && status != C.VE_ERROR_BUFFER_TOO_SMALL {
+			return value, Status(status)
+		}
+	}
+	value, status := v.single(protect, "", data, "", false)
+	return value, Status(status)
 }
 
 func (v *VoltageFPE) Protect(data string) string {
-	cStr := C.VoltageProtect(v.ctx, C.CString(data))
-	return C.GoString(cStr)
+	value, _ := v.call(true, data)
+	return value
 }
 
 func (v *VoltageFPE) Access(ciphertext string) string {
-	cStr := C.VoltageAccess(v.ctx, C.CString(ciphertext))
-	return C.GoString(cStr)
+	value, _ := v.call(false, ciphertext)
+	return value
+}
+
+// AccessMasked returns the plaintext with the format's policy masking rule
+// applied by the vendor library, so the full value never reaches Go.
+func (v *VoltageFPE) AccessMasked(ciphertext string) string {
+	value, _ := v.single(false, "", ciphertext, "", true)
+	return value
+}
+
+// ProtectFormat protects data with format instead of the format the context
+// was created with; the FPE objects for format are created on first use.
+func (v *VoltageFPE) ProtectFormat(format, data string) string {
+	value, _ := v.single(true, format, data, "", false)
+	return value
+}
+
+func (v *VoltageFPE) AccessFormat(format, ciphertext string) string {
+	value, _ := v.single(false, format, ciphertext, "", false)
+	return value
+}
+
+// ProtectTweak protects data with the default format and an FPE tweak, so
+// equal plaintexts with different tweaks yield different ciphertexts.
+func (v *VoltageFPE) ProtectTweak(data, tweak string) string {
+	value, _ := v.single(true, "", data, tweak, false)
+	return value
+}
+
+func (v *VoltageFPE) AccessTweak(ciphertext, tweak string) string {
+	value, _ := v.single(false, "", ciphertext, tweak, false)
+	return value
+}
+
+func directionMask(protect, access bool) C.int {
+	var mask C.int
+	if protect {
+		mask |= C.VOLTAGE_DIRECTION_PROTECT
+	}
+	if access {
+		mask |= C.VOLTAGE_DIRECTION_ACCESS
+	}
+	return mask
+}
+
+// Materialize creates the protect and/or access FPE objects for format (""
+// selects the default format) ahead of first use; otherwise each direction
+// is created lazily by the first call that needs it.
+func (v *VoltageFPE) Materialize(format string, protect, access bool) error {
+	cFormat := C.CString(format)
+	defer C.free(unsafe.Pointer(cFormat))
+
+	if status := C.VoltageMaterialize(v.ctx, cFormat, directionMask(protect, access)); status != 0 {
+		return fmt.Errorf("voltage FPE creation for format '%s' failed: %w", format, Status(status))
+	}
+	return nil
+}
+
+// Materialized reports which directions of format already have FPE objects.
+func (v *VoltageFPE) Materialized(format string) (protect, access bool) {
+	cFormat := C.CString(format)
+	defer C.free(unsafe.Pointer(cFormat))
+
+	mask := C.VoltageMaterializedDirections(v.ctx, cFormat)
+	return mask&C.VOLTAGE_DIRECTION_PROTECT != 0, mask&C.VOLTAGE_DIRECTION_ACCESS != 0
+}
+
+// WarmUp materializes format ("" selects the default format) and runs a
+// throwaway protect and/or access so its key is fetched and cached before
+// real traffic arrives.
+func (v *VoltageFPE) WarmUp(format string, protect, access bool) error {
+	name, owned := v.cFormat(format)
+	if owned {
+		defer C.free(unsafe.Pointer(name))
+	}
+	if status := C.VoltageWarmUp(v.ctx, name, directionMask(protect, access)); status != 0 {
+		return fmt.Errorf("voltage warm-up for format '%s' failed with status %d", format, int(status))
+	}
+	return nil
+}
+
+type WarmUpResult struct {
+	ID       string
+	Format   string
+	Duration time.Duration
+	Err      error
+}
+
+// WarmUp warms every registration in ids for each of formats (none means the
+// default format) in parallel and reports how long each took. A registration
+// is warmed in the directions it materialized when it was registered, or in
+// both if it materialized none. Call it before the instance reports ready.
+func WarmUp(ids []string, formats ...string) []WarmUpResult {
+	if len(formats) == 0 {
+		formats = []string{""}
+	}
+	results := make([]WarmUpResult, 0, len(ids)*len(formats))
+	for _, id := range ids {
+		for _, format := range formats {
+			results = append(results, WarmUpResult{ID: id, Format: format})
+		}
+	}
+
+	var wg sync.WaitGroup
+	for i := range results {
+		wg.Add(1)
+		go func(r *WarmUpResult) {
+			defer wg.Done()
+			e, err := acquireByID(r.ID)
+			if err != nil {
+				r.Err = err
+				return
+			}
+			defer e.release()
+			protect, access := e.fpe.Materialized("")
+			if !protect && !access {
+				protect, access = true, true
+			}
+			start := time.Now()
+			r.Err = e.fpe.WarmUp(r.Format, protect, access)
+			r.Duration = time.Since(start)
+		}(&results[i])
+	}
+	wg.Wait()
+	return results
+}
+
+// cBatchInputs describes values with an array of (pointer, length) pairs that
+// point straight at the Go strings, pinned for the duration of the call so the
+// array itself may live in Go memory. Call the returned func to unpin them.
+func cBatchInputs(values []string) (*C.VeConstByteArray, func()) {
+	var pinner runtime.Pinner
+	inputs := make([]C.VeConstByteArray, len(values)+1)
+	for i, s := range values {
+		ptr, size := cInput(s)
+		pinner.Pin(ptr)
+		inputs[i].ptr = ptr
+		inputs[i].size = size
+	}
+	return &inputs[0], pinner.Unpin
+}
+
+// cBatchFormats builds a C array holding one format name per item, sharing a
+// single C string between items that use the same format. A nil formats slice
+// yields a NULL array, which selects the context's default format.
+func cBatchFormats(formats []string) (**C.char, func()) {
+	if formats == nil {
+		return nil, func() {}
+	}
+	names := make(map[string]*C.char)
+	array := C.malloc(C.size_t(len(formats)) * C.size_t(unsafe.Sizeof((*C.char)(nil))))
+	items := unsafe.Slice((**C.char)(array), len(formats))
+	for i, f := range formats {
+		name, ok := names[f]
+		if !ok {
+			name = C.CString(f)
+			names[f] = name
+		}
+		items[i] = name
+	}
+
+	return (**C.char)(array), func() {
+		for _, name := range names {
+			C.free(unsafe.Pointer(name))
+		}
+		C.free(array)
+	}
+}
+
+// cBatchTweaks is cBatchInputs for an optional per-item tweak column.
+func cBatchTweaks(tweaks []string) (*C.VeConstByteArray, func()) {
+	if tweaks == nil {
+		return nil, func() {}
+	}
+	return cBatchInputs(tweaks)
+}
+
+// splitBatchOutput turns the output region and offsets of a batch call into
+// strings sharing one backing allocation.
+func splitBatchOutput(out []byte, offsets []C.uint) []string {
+	n := len(offsets) - 1
+	all := string(out[:offsets[n]])
+	results := make([]string, n)
+	for i := 0; i < n; i++ {
+		results[i] = all[offsets[i]:offsets[i+1]]
+	}
+	return results
+}
+
+type batchCall func(inputs *C.VeConstByteArray, count C.uint, out *C.uchar, size C.uint, offsets *C.uint) C.int
+
+// formatSizing returns the shim's output bound for format as scale*n+slack,
+// cached per context so batch sizing costs no extra native call.
+func (v *VoltageFPE) formatSizing(format string) (int, int) {
+	if sizing, ok := v.sizing.Load(format); ok {
+		s := sizing.([2]int)
+		return s[0], s[1]
+	}
+	name, owned := v.cFormat(format)
+	if owned {
+		defer C.free(unsafe.Pointer(name))
+	}
+	var scale, slack C.uint
+	if C.VoltageFormatSizing(v.ctx, name, &scale, &slack) != 0 {
+		return 2, 16
+	}
+	if !owned {
+		v.sizing.Store(format, [2]int{int(scale), int(slack)})
+	}
+	return int(scale), int(slack)
+}
+
+// batchOutputSize is the output region a batch over values needs; for the
+// length-preserving formats the shim knows it is exact.
+func (v *VoltageFPE) batchOutputSize(formats, values []string) int {
+	size := 1
+	format := ""
+	scale, slack := v.formatSizing(format)
+	for i, s := range values {
+		if formats != nil && formats[i] != format {
+			format = formats[i]
+			scale, slack = v.formatSizing(format)
+		}
+		size += scale*len(s) + slack
+	}
+	return size
+}
+
+// runBatch calls with an output region of size bytes. On
+// VE_ERROR_BUFFER_TOO_SMALL the shim reports the size the batch needs, so the
+// region is regrown to exactly that and the batch retried once; regions never
+// exceed VOLTAGE_MAX_BATCH_OUTPUT_SIZE.
+func runBatch(values []string, size int, call batchCall) ([]string, int) {
+	inputs, free := cBatchInputs(values)
+	defer free()
+
+	offsets := make([]C.uint, len(values)+1)
+	size = min(size, C.VOLTAGE_MAX_BATCH_OUTPUT_SIZE)
+	for {
+		out := make([]byte, size)
+		status := call(inputs, C.uint(len(values)), (*C.uchar)(unsafe.Pointer(&out[0])), C.uint(len(out)), &offsets[0])
+		if status == C.VE_ERROR_BUFFER_TOO_SMALL {
+			needed := int(offsets[len(values)])
+			if needed <= size || needed > C.VOLTAGE_MAX_BATCH_OUTPUT_SIZE {
+				return nil, int(status)
+			}
+			size = needed
+			continue
+		}
+		if status != 0 {
+			return nil, int(status)
+		}
+		return splitBatchOutput(out, offsets), 0
+	}
+}
+
+func (v *VoltageFPE) ProtectBatch(values []string) ([]string, error) {
+	results, _, err := v.protectBatch(nil, values, nil, false)
+	return results, err
+}
+
+// ProtectBatchStatuses is ProtectBatch with one status per value: a value
+// that fails comes back empty with its status instead of failing the batch,
+// so callers can skip user-data errors and retry only retryable ones.
+func (v *VoltageFPE) ProtectBatchStatuses(values []string) ([]string, []Status, error) {
+	return v.protectBatch(nil, values, nil, true)
+}
+
+// ProtectBatchTweaked protects values[i] with tweaks[i], e.g. a record-ID
+// column, in the same single native call as ProtectBatch.
+func (v *VoltageFPE) ProtectBatchTweaked(values, tweaks []string) ([]string, error) {
+	if len(tweaks) != len(values) {
+		return nil, fmt.Errorf("got %d tweaks for %d values", len(tweaks), len(values))
+	}
+	results, _, err := v.protectBatch(nil, values, tweaks, false)
+	return results, err
+}
+
+// ProtectRecord protects values[i] with formats[i], so a record with fields
+// of different formats costs a single native call.
+func (v *VoltageFPE) ProtectRecord(formats, values []string) ([]string, error) {
+	if len(formats) != len(values) {
+		return nil, fmt.Errorf("got %d formats for %d values", len(formats), len(values))
+	}
+	results, _, err := v.protectBatch(formats, values, nil, false)
+	return results, err
+}
+
+func (v *VoltageFPE) protectBatch(formats, values, tweaks []string, perItem bool) ([]string, []Status, error) {
+	if len(values) == 0 {
+		return nil, nil, nil
+	}
+	cFormats, free := cBatchFormats(formats)
+	defer free()
+	cTweaks, freeTweaks := cBatchTweaks(tweaks)
+	defer freeTweaks()
+
+	var cStatuses []C.int
+	var statusPtr *C.int
+	if perItem {
+		cStatuses = make([]C.int, len(values))
+		statusPtr = &cStatuses[0]
+	}
+	results, status := runBatch(values, v.batchOutputSize(formats, values), func(inputs *C.VeConstByteArray, count C.uint, out *C.uchar, size C.uint, offsets *C.uint) C.int {
+		return C.VoltageProtectBatch(v.ctx, cFormats, inputs, cTweaks, count, out, size, offsets, statusPtr)
+	})
+	if status != 0 {
+		v.noteStatus(Status(status))
+		return nil, nil, fmt.Errorf("voltage batch protect failed with status %d", status)
+	}
+	if !perItem {
+		return results, nil, nil
+	}
+	statuses := toStatuses(cStatuses)
+	v.noteStatuses(statuses)
+	return results, statuses, nil
+}
+
+// AccessBatch returns one status code per ciphertext; items with a non-zero
+// status come back as empty strings without failing the rest of the batch.
+func (v *VoltageFPE) AccessBatch(ciphertexts []string) ([]string, []Status, error) {
+	return v.accessBatch(nil, ciphertexts, nil, false)
+}
+
+func (v *VoltageFPE) AccessMaskedBatch(ciphertexts []string) ([]string, []Status, error) {
+	return v.accessBatch(nil, ciphertexts, nil, true)
+}
+
+func (v *VoltageFPE) AccessBatchTweaked(ciphertexts, tweaks []string) ([]string, []Status, error) {
+	if len(tweaks) != len(ciphertexts) {
+		return nil, nil, fmt.Errorf("got %d tweaks for %d values", len(tweaks), len(ciphertexts))
+	}
+	return v.accessBatch(nil, ciphertexts, tweaks, false)
+}
+
+func (v *VoltageFPE) AccessRecord(formats, ciphertexts []string) ([]string, []Status, error) {
+	if len(formats) != len(ciphertexts) {
+		return nil, nil, fmt.Errorf("got %d formats for %d values", len(formats), len(ciphertexts))
+	}
+	return v.accessBatch(formats, ciphertexts, nil, false)
+}
+
+func (v *VoltageFPE) accessBatch(formats, ciphertexts, tweaks []string, masked bool) ([]string, []Status, error) {
+	if len(ciphertexts) == 0 {
+		return nil, nil, nil
+	}
+	cFormats, free := cBatchFormats(formats)
+	defer free()
+	cTweaks, freeTweaks := cBatchTweaks(tweaks)
+	defer freeTweaks()
+
+	cStatuses := make([]C.int, len(ciphertexts))
+	results, status := runBatch(ciphertexts, v.batchOutputSize(formats, ciphertexts), func(inputs *C.VeConstByteArray, count C.uint, out *C.uchar, size C.uint, offsets *C.uint) C.int {
+		if masked {
+			return C.VoltageAccessMaskedBatch(v.ctx, cFormats, inputs, cTweaks, count, out, size, offsets, &cStatuses[0])
+		}
+		return C.VoltageAccessBatch(v.ctx, cFormats, inputs, cTweaks, count, out, size, offsets, &cStatuses[0])
+	})
+	if status != 0 {
+		v.noteStatus(Status(status))
+		return nil, nil, fmt.Errorf("voltage batch access failed with status %d", status)
+	}
+	statuses := toStatuses(cStatuses)
+	v.noteStatuses(statuses)
+	return results, statuses, nil
+}
+
+// dateSeries runs a whole datetime sequence through one data-range call, so
+// the protected (or recovered) values keep the original deltas between them.
+func (v *VoltageFPE) dateSeries(protect bool, format string, values []string) ([]string, error) {
+	if len(values) == 0 {
+		return nil, nil
+	}
+	inputs, free := cBatchInputs(values)
+	defer free()
+	cFormat, owned := v.cFormat(format)
+	if owned {
+		defer C.free(unsafe.Pointer(cFormat))
+	}
+
+	slot := 0
+	for _, s := range values {
+		if len(s) > slot {
+			slot = len(s)
+		}
+	}
+	scale, slack := v.formatSizing(format)
+	slot = max(1, scale*slot+slack)
+	sizes := make([]C.uint, len(values))
+	for {
+		out := make([]byte, slot*len(values))
+		outPtr := (*C.uchar)(unsafe.Pointer(&out[0]))
+		var status C.int
+		if protect {
+			status = C.VoltageProtectDataRanges(v.ctx, cFormat, inputs, C.uint(len(values)), outPtr, C.uint(slot), &sizes[0])
+		} else {
+			status = C.VoltageAccessDataRanges(v.ctx, cFormat, inputs, C.uint(len(values)), outPtr, C.uint(slot), &sizes[0])
+		}
+		if status == C.VE_ERROR_BUFFER_TOO_SMALL && slot < C.VOLTAGE_MAX_OUTPUT_SIZE/len(values) {
+			slot *= 2
+			continue
+		}
+		if status != 0 {
+			return nil, fmt.Errorf("voltage date range operation failed with status %d", int(status))
+		}
+
+		all := string(out)
+		results := make([]string, len(values))
+		for i, size := range sizes {
+			results[i] = all[i*slot : i*slot+int(size)]
+		}
+		return results, nil
+	}
+}
+
+// ProtectDateSeries protects a sequence of datetimes with a date format
+// ("" selects the default format) while preserving the intervals between them.
+func (v *VoltageFPE) ProtectDateSeries(format string, dates []string) ([]string, error) {
+	return v.dateSeries(true, format, dates)
+}
+
+func (v *VoltageFPE) AccessDateSeries(format string, dates []string) ([]string, error) {
+	return v.dateSeries(false, format, dates)
 }
 
 func (v *VoltageFPE) Close() {
+	v.DisableCoalescing()
+	v.DisableRing()
+	v.pending.Wait()
 	C.DestroyVoltageFPEContext(v.ctx)
+	v.formats.Range(func(_, name any) bool {
+		C.free(unsafe.Pointer(name.(*C.char)))
+		return true
+	})
 }
 
-func RegisterFPE(id, policyURL, trustPath, cachePath, identity, secret, format string) error {
-	fpe := NewVoltageFPE(policyURL, trustPath, cachePath, identity, secret, format)
+// SharedLibraryContextCount reports how many VeLibCtx instances the shim
+// currently shares across registrations.
+func SharedLibraryContextCount() int {
+	return int(C.VoltageSharedLibCtxCount())
+}
 
-	fpeStoreLock.Lock()
-	defer fpeStoreLock.Unlock()
-	fpeStore[id] = fpe
+func RegisterFPE(id, policyURL, trustPath, cachePath, identity, secret, format string) error {
+	fpe, err := createVoltageFPE(policyURL, trustPath, cachePath, identity, secret, format)
+	if err != nil {
+		return err
+	}
 
+	publish(id, fpe)
 	return nil
 }
 
+type Registration struct {
+	ID        string
+	PolicyURL string
+	TrustPath string
+	CachePath string
+	Identity  string
+	Secret    string
+	Format    string
+
+	Directions []string // "protect", "access"; empty means both
+}
+
+type RegistrationResult struct {
+	ID       string
+	Duration time.Duration
+	Err      error
+}
+
+// RegisterFPEs creates the contexts for regs with at most parallelism builds
+// in flight, materializing the requested directions of each default format,
+// and publishes each registration as soon as it is ready. Results are in the
+// order of regs.
+func RegisterFPEs(regs []Registration, parallelism int) []RegistrationResult {
+	if parallelism < 1 {
+		parallelism = 1
+	}
+	results := make([]RegistrationResult, len(regs))
+	slots := make(chan struct{}, parallelism)
+
+	var wg sync.WaitGroup
+	for i := range regs {
+		wg.Add(1)
+		slots <- struct{}{}
+		go func(reg *Registration, r *RegistrationResult) {
+			defer wg.Done()
+			defer func() { <-slots }()
+
+			r.ID = reg.ID
+			start := time.Now()
+			protect, access, err := parseDirections(reg.Directions)
+			var fpe *VoltageFPE
+			if err == nil {
+				fpe, err = createVoltageFPE(reg.PolicyURL, reg.TrustPath, reg.CachePath, reg.Identity, reg.Secret, reg.Format)
+			}
+			if err == nil {
+				if err = fpe.Materialize("", protect, access); err != nil {
+					fpe.Close()
+				}
+			}
+			r.Duration = time.Since(start)
+			if err != nil {
+				r.Err = fmt.Errorf("registering FPE '%s': %w", reg.ID, err)
+				return
+			}
+			publish(reg.ID, fpe)
+		}(&regs[i], &results[i])
+	}
+	wg.Wait()
+	return results
+}
+
+// DeleteAllFPEs unregisters every FPE, including those loaded from a
+// registry config. Contexts still in use by in-flight calls are closed when
+// those calls return; handles stay interned.
 func DeleteAllFPEs() {
-	fpeStoreLock.Lock()
-	defer fpeStoreLock.Unlock()
+	registryLock.Lock()
+	pendingFPEs.Range(func(id, r any) bool {
+		r.(*Readiness).cancelled.Store(true)
+		pendingFPEs.Delete(id)
+		return true
+	})
+	next := registry.Load().clone()
+	old := next.entries
+	next.entries = make([]*registryEntry, len(old))
+	registry.Store(next)
+	registryLock.Unlock()
 
-	for _, fpe := range fpeStore {
-		fpe.Close()
+	for _, e := range old {
+		if e != nil {
+			e.release()
+		}
 	}
-	fpeStore = make(map[string]*VoltageFPE)
 }
 
-func EncryptByID(id, data string) (string, error) {
-	fpeStoreLock.RLock()
-	defer fpeStoreLock.RUnlock()
+// statusResult turns a failed status into the error of a ByID call, so
+// callers can tell rejected data from transient failures with errors.As.
+func statusResult(value string, status Status) (string, error) {
+	if status != StatusOK {
+		return "", status
+	}
+	return value, nil
+}
 
-	fpe, ok := fpeStore[id]
-	if !ok {
-		return "", fmt.Errorf("FPE with id '%s' not found", id)
+func EncryptByID(id, data string) (string, error) {
+	e, err := acquireByID(id)
+	if err != nil {
+		return "", err
 	}
-	return fpe.Protect(data), nil
+	defer e.release()
+	return statusResult(e.fpe.ProtectStatus(data))
 }
 
 func DecryptByID(id, cipher string) (string, error) {
-	fpeStoreLock.RLock()
-	defer fpeStoreLock.RUnlock()
+	e, err := acquireByID(id)
+	if err != nil {
+		return "", err
+	}
+	defer e.release()
+	return statusResult(e.fpe.AccessStatus(cipher))
+}
+
+func EncryptBatchByID(id string, values []string) ([]string, error) {
+	e, err := acquireByID(id)
+	if err != nil {
+		return nil, err
+	}
+	defer e.release()
+	return e.fpe.ProtectBatch(values)
+}
+
+func EncryptBatchStatusesByID(id string, values []string) ([]string, []Status, error) {
+	e, err := acquireByID(id)
+	if err != nil {
+		return nil, nil, err
+	}
+	defer e.release()
+	return e.fpe.ProtectBatchStatuses(values)
+}
+
+func DecryptBatchByID(id string, ciphertexts []string) ([]string, []Status, error) {
+	e, err := acquireByID(id)
+	if err != nil {
+		return nil, nil, err
+	}
+	defer e.release()
+	return e.fpe.AccessBatch(ciphertexts)
+}
+
+func EncryptByIDFormat(id, format, data string) (string, error) {
+	e, err := acquireByID(id)
+	if err != nil {
+		return "", err
+	}
+	defer e.release()
+	value, status := e.fpe.single(true, format, data, "", false)
+	return statusResult(value, Status(status))
+}
+
+func DecryptByIDFormat(id, format, cipher string) (string, error) {
+	e, err := acquireByID(id)
+	if err != nil {
+		return "", err
+	}
+	defer e.release()
+	value, status := e.fpe.single(false, format, cipher, "", false)
+	return statusResult(value, Status(status))
+}
+
+func EncryptRecordByID(id string, formats, values []string) ([]string, error) {
+	e, err := acquireByID(id)
+	if err != nil {
+		return nil, err
+	}
+	defer e.release()
+	return e.fpe.ProtectRecord(formats, values)
+}
+
+func DecryptRecordByID(id string, formats, ciphertexts []string) ([]string, []Status, error) {
+	e, err := acquireByID(id)
+	if err != nil {
+		return nil, nil, err
+	}
+	defer e.release()
+	return e.fpe.AccessRecord(formats, ciphertexts)
+}
+
+func EncryptByIDTweak(id, data, tweak string) (string, error) {
+	e, err := acquireByID(id)
+	if err != nil {
+		return "", err
+	}
+	defer e.release()
+	value, status := e.fpe.single(true, "", data, tweak, false)
+	return statusResult(value, Status(status))
+}
+
+func DecryptByIDTweak(id, cipher, tweak string) (string, error) {
+	e, err := acquireByID(id)
+	if err != nil {
+		return "", err
+	}
+	defer e.release()
+	value, status := e.fpe.single(false, "", cipher, tweak, false)
+	return statusResult(value, Status(status))
+}
+
+func EncryptBatchByIDTweaked(id string, values, tweaks []string) ([]string, error) {
+	e, err := acquireByID(id)
+	if err != nil {
+		return nil, err
+	}
+	defer e.release()
+	return e.fpe.ProtectBatchTweaked(values, tweaks)
+}
+
+func DecryptBatchByIDTweaked(id string, ciphertexts, tweaks []string) ([]string, []Status, error) {
+	e, err := acquireByID(id)
+	if err != nil {
+		return nil, nil, err
+	}
+	defer e.release()
+	return e.fpe.AccessBatchTweaked(ciphertexts, tweaks)
+}
+
+func DecryptMaskedByID(id, cipher string) (string, error) {
+	e, err := acquireByID(id)
+	if err != nil {
+		return "", err
+	}
+	defer e.release()
+	value, status := e.fpe.single(false, "", cipher, "", true)
+	return statusResult(value, Status(status))
+}
+
+func DecryptMaskedBatchByID(id string, ciphertexts []string) ([]string, []Status, error) {
+	e, err := acquireByID(id)
+	if err != nil {
+		return nil, nil, err
+	}
+	defer e.release()
+	return e.fpe.AccessMaskedBatch(ciphertexts)
+}
+
+func ProtectDateSeriesByID(id, format string, dates []string) ([]string, error) {
+	e, err := acquireByID(id)
+	if err != nil {
+		return nil, err
+	}
+	defer e.release()
+	return e.fpe.ProtectDateSeries(format, dates)
+}
 
-	fpe, ok := fpeStore[id]
-	if !ok {
-		return "", fmt.Errorf("FPE with id '%s' not found", id)
+func AccessDateSeriesByID(id, format string, dates []string) ([]string, error) {
+	e, err := acquireByID(id)
+	if err != nil {
+		return nil, err
 	}
-	return fpe.Access(cipher), nil
+	defer e.release()
+	return e.fpe.AccessDateSeries(format, dates)
 }
@@ -0,0 +1,185 @@
+package main
+
+/*
+#include <stdlib.h>
+#include "voltage_fpe.h"
+*/
+import "C"
+import (
+	"errors"
+	"fmt"
+	"runtime/cgo"
+	"sync"
+	"sync/atomic"
+	"unsafe"
+)
+
+type AsyncResult struct {
+	Value string
+	Err   error
+}
+
+type asyncJob struct {
+	fpe  *VoltageFPE
+	op   string
+	done chan AsyncResult
+}
+
+// WorkerPool runs protect/access operations on a fixed set of native threads.
+// Each submission costs one short cgo call; results come back through a
+// single reaper goroutine polling the pool's completion queue.
+type WorkerPool struct {
+	pool    *C.VoltageWorkerPool
+	pending sync.WaitGroup
+	closed  atomic.Bool
+	// mu is held shared by submits and exclusively by Close, so no submit
+	// is inside a cgo call or between its check and pending.Add when the
+	// pool shuts down.
+	mu      sync.RWMutex
+	stop    chan struct{}
+	stopped chan struct{}
+}
+
+var errPoolClosed = errors.New("voltage worker pool is closed")
+
+var emptyInput byte
+
+// cInput returns a pointer/length pair C may read for the duration of a call.
+func cInput(s string) (*C.uchar, C.uint) {
+	if len(s) == 0 {
+		return (*C.uchar)(unsafe.Pointer(&emptyInput)), 0
+	}
+	return (*C.uchar)(unsafe.Pointer(unsafe.StringData(s))), C.uint(len(s))
+}
+
+func NewWorkerPool(threads, queueCapacity int) (*WorkerPool, error) {
+	pool := C.VoltageCreateWorkerPool(C.int(threads), C.uint(queueCapacity))
+	if pool == nil {
+		return nil, fmt.Errorf("failed to start Voltage worker pool with %d threads", threads)
+	}
+	p := &WorkerPool{
+		pool:    pool,
+		stop:    make(chan struct{}),
+		stopped: make(chan struct{}),
+	}
+	go p.reap()
+	return p, nil
+}
+
+func (p *WorkerPool) reap() {
+	defer close(p.stopped)
+
+	completions := make([]C.VoltageCompletion, 64)
+	for {
+		n := C.VoltagePollCompletions(p.pool, &completions[0], C.uint(len(completions)), 50)
+		for _, c := range completions[:n] {
+			h := cgo.Handle(c.tag)
+			job := h.Value().(*asyncJob)
+			h.Delete()
+
+			var result AsyncResult
+			if c.status != 0 {
+				job.fpe.noteStatus(Status(c.status))
+				result.Err = fmt.Errorf("voltage %s failed with status %d", job.op, int(c.status))
+			} else {
+				result.Value = C.GoStringN((*C.char)(unsafe.Pointer(c.output)), C.int(c.outputLen))
+			}
+			job.done <- result
+			job.fpe.pending.Done()
+			p.pending.Done()
+		}
+		if n > 0 {
+			C.VoltageReleaseCompletions(&completions[0], n)
+			continue
+		}
+		select {
+		case <-p.stop:
+			return
+		default:
+		}
+	}
+}
+
+func (p *WorkerPool) submit(fpe *VoltageFPE, protect bool, format, data string) <-chan AsyncResult {
+	job := &asyncJob{fpe: fpe, op: "access", done: make(chan AsyncResult, 1)}
+	if protect {
+		job.op = "protect"
+	}
+
+	p.mu.RLock()
+	defer p.mu.RUnlock()
+	if p.closed.Load() {
+		job.done <- AsyncResult{Err: errPoolClosed}
+		return job.done
+	}
+
+	var cFormat *C.char
+	if format != "" {
+		cFormat = C.CString(format)
+		defer C.free(unsafe.Pointer(cFormat))
+	}
+	input, size := cInput(data)
+	h := cgo.NewHandle(job)
+
+	fpe.pending.Add(1)
+	p.pending.Add(1)
+	var status C.int
+	if protect {
+		status = C.VoltageSubmitProtect(p.pool, fpe.ctx, cFormat, input, size, C.uintptr_t(h), nil, nil)
+	} else {
+		status = C.VoltageSubmitAccess(p.pool, fpe.ctx, cFormat, input, size, C.uintptr_t(h), nil, nil)
+	}
+	if status != 0 {
+		h.Delete()
+		fpe.pending.Done()
+		p.pending.Done()
+		if status == C.VOLTAGE_ERROR_POOL_CLOSED {
+			job.done <- AsyncResult{Err: errPoolClosed}
+		} else {
+			job.done <- AsyncResult{Err: fmt.Errorf("voltage %s submit failed with status %d", job.op, int(status))}
+		}
+	}
+	return job.done
+}
+
+func (p *WorkerPool) SubmitProtect(fpe *VoltageFPE, format, data string) <-chan AsyncResult {
+	return p.submit(fpe, true, format, data)
+}
+
+func (p *WorkerPool) SubmitAccess(fpe *VoltageFPE, format, ciphertext string) <-chan AsyncResult {
+	return p.submit(fpe, false, format, ciphertext)
+}
+
+// Close waits for every submitted operation to complete, then stops the
+// native threads. Submits arriving afterwards get errPoolClosed.
+func (p *WorkerPool) Close() {
+	p.mu.Lock()
+	wasClosed := p.closed.Swap(true)
+	p.mu.Unlock()
+	if wasClosed {
+		return
+	}
+	p.pending.Wait()
+	close(p.stop)
+	<-p.stopped
+	C.VoltageDestroyWorkerPool(p.pool)
+	p.pool = nil
+}
+
+func EncryptAsyncByID(pool *WorkerPool, id, data string) (<-chan AsyncResult, error) {
+	e, err := acquireByID(id)
+	if err != nil {
+		return nil, err
+	}
+	defer e.release()
+	return pool.SubmitProtect(e.fpe, "", data), nil
+}
+
+func DecryptAsyncByID(pool *WorkerPool, id, cipher string) (<-chan AsyncResult, error) {
+	e, err := acquireByID(id)
+	if err != nil {
+		return nil, err
+	}
+	defer e.release()
+	return pool.SubmitAccess(e.fpe, "", cipher), nil
+}
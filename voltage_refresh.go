@@ -0,0 +1,225 @@
+package main
+
+/*
+#include "voltage_fpe.h"
+*/
+import "C"
+import (
+	"errors"
+	"fmt"
+	"math/rand"
+	"sync"
+	"sync/atomic"
+	"time"
+)
+
+const (
+	expiryRetryMinDelay = time.Second
+	expiryRetryMaxDelay = time.Minute
+)
+
+// refreshLocks serializes refreshes of one id so concurrent triggers build
+// one replacement after another instead of racing to replace.
+var refreshLocks sync.Map // id -> *sync.Mutex
+
+// RefreshFPE builds a replacement for the context registered under id from
+// the same configuration, fetches the keys of every format and direction the
+// current context has materialized, and then swaps it in. Calls already
+// running finish on the old context, which is closed once they have drained;
+// until the swap, traffic keeps using the old one.
+func RefreshFPE(id string) error {
+	return refreshFPE(id, nil)
+}
+
+// RotateSecret is RefreshFPE with a new shared secret for the replacement.
+func RotateSecret(id, secret string) error {
+	return refreshFPE(id, func(c *ContextConfig) { c.SharedSecret = secret })
+}
+
+func refreshFPE(id string, edit func(*ContextConfig)) error {
+	mu, _ := refreshLocks.LoadOrStore(id, &sync.Mutex{})
+	mu.(*sync.Mutex).Lock()
+	defer mu.(*sync.Mutex).Unlock()
+
+	e, err := acquireByID(id)
+	if err != nil {
+		return err
+	}
+	defer e.release()
+	current := e.fpe
+
+	c := current.config
+	if edit != nil {
+		edit(&c)
+	}
+	fpe, err := rebuild(c, current.fromSnapshot)
+	if err != nil {
+		return err
+	}
+	if err := fpe.inherit(current); err != nil {
+		fpe.Close()
+		return err
+	}
+	if !replace(id, current, fpe) {
+		fpe.Close()
+		return fmt.Errorf("FPE with id '%s' was re-registered during refresh", id)
+	}
+	if fpe.fromSnapshot {
+		online := c
+		online.PolicyFilePath = ""
+		go refreshFromPolicyURL(id, fpe, online, c.PolicyFilePath)
+	}
+	return nil
+}
+
+// rebuild creates a context from c. A context that was started from a policy
+// snapshot is rebuilt online when the policy server answers, and from the
+// snapshot again otherwise.
+func rebuild(c ContextConfig, fromSnapshot bool) (*VoltageFPE, error) {
+	if !fromSnapshot || c.PolicyURL == "" {
+		return newVoltageFPEFromConfig(c)
+	}
+	online := c
+	online.PolicyFilePath = ""
+	if fpe, err := newVoltageFPEFromConfig(online); err == nil {
+		return fpe, nil
+	}
+	fpe, err := newVoltageFPEFromConfig(c)
+	if err != nil {
+		return nil, err
+	}
+	fpe.fromSnapshot = true
+	return fpe, nil
+}
+
+// inherit warms v for every format and direction old has materialized and
+// carries over old's coalescing, ring and expiry settings.
+func (v *VoltageFPE) inherit(old *VoltageFPE) error {
+	formats := []string{""}
+	old.formats.Range(func(format, _ any) bool {
+		formats = append(formats, format.(string))
+		return true
+	})
+	for _, format := range formats {
+		protect, access := old.Materialized(format)
+		if !protect && !access {
+			continue
+		}
+		if err := v.WarmUp(format, protect, access); err != nil {
+			return err
+		}
+	}
+
+	if c := old.coalescer.Load(); c != nil {
+		var err error
+		if c.ctl != nil {
+			err = v.EnableAdaptiveCoalescing(c.ctl.target, c.ctl.maxWindow, c.ctl.maxBatch)
+		} else {
+			err = v.EnableCoalescing(c.window, c.maxBatch)
+		}
+		if err != nil {
+			return err
+		}
+	}
+	if r := old.ring.Load(); r != nil {
+		if err := v.EnableRing(r.threads, r.capacity, r.firstCPU); err != nil {
+			return err
+		}
+	}
+	if f := old.onExpired.Load(); f != nil {
+		v.onExpired.Store(f)
+	}
+	return nil
+}
+
+// noteStatus fires the context's expiry hook the first time a call reports
+// VE_ERROR_AUTHORIZATION_EXPIRED. The hook re-arms it only after a backoff
+// when the refresh fails, so a burst of expired calls costs one rebuild.
+func (v *VoltageFPE) noteStatus(s Status) {
+	if s != C.VE_ERROR_AUTHORIZATION_EXPIRED {
+		return
+	}
+	if f := v.onExpired.Load(); f != nil && v.expired.CompareAndSwap(false, true) {
+		go (*f)()
+	}
+}
+
+func (v *VoltageFPE) noteStatuses(statuses []Status) {
+	if v.onExpired.Load() == nil || v.expired.Load() {
+		return
+	}
+	for _, s := range statuses {
+		if s == C.VE_ERROR_AUTHORIZATION_EXPIRED {
+			v.noteStatus(s)
+			return
+		}
+	}
+}
+
+// AutoRefreshFPE refreshes the context registered under id every interval
+// (with up to 10% jitter so registrations do not rotate in lockstep) and
+// immediately when a call on it reports an expired authorization. Pick an
+// interval shorter than the authorization lifetime so a replacement is
+// normally in place before the old one expires. onError, if non-nil,
+// receives failed refreshes; the old context stays in service until one
+// succeeds, and expiry on it triggers the next attempt only after a backoff
+// of 1s doubling up to 1min. Call stop to end it.
+func AutoRefreshFPE(id string, interval time.Duration, onError func(error)) (stop func(), err error) {
+	if interval <= 0 {
+		return nil, errors.New("refresh interval must be positive")
+	}
+	e, err := acquireByID(id)
+	if err != nil {
+		return nil, err
+	}
+	defer e.release()
+
+	var stopped atomic.Bool
+	var failures atomic.Int64
+	refresh := func() {
+		if stopped.Load() {
+			return
+		}
+		current := registeredFPE(id)
+		err := RefreshFPE(id)
+		if err == nil {
+			failures.Store(0)
+			return
+		}
+		if current != nil {
+			n := min(failures.Add(1)-1, 6)
+			delay := min(expiryRetryMinDelay<<n, expiryRetryMaxDelay)
+			time.AfterFunc(delay, func() { current.expired.Store(false) })
+		}
+		if onError != nil {
+			onError(err)
+		}
+	}
+	e.fpe.onExpired.Store(&refresh)
+
+	done := make(chan struct{})
+	go func() {
+		for {
+			jitter := time.Duration(rand.Int63n(int64(interval)/10 + 1))
+			timer := time.NewTimer(interval - jitter)
+			select {
+			case <-timer.C:
+				refresh()
+			case <-done:
+				timer.Stop()
+				return
+			}
+		}
+	}()
+
+	var once sync.Once
+	return func() {
+		once.Do(func() {
+			stopped.Store(true)
+			close(done)
+			if fpe := registeredFPE(id); fpe != nil {
+				fpe.onExpired.Store(nil)
+			}
+		})
+	}, nil
+}
@@ -0,0 +1,223 @@
+package main
+
+import (
+	"fmt"
+	"sync"
+	"sync/atomic"
+)
+
+// FPEHandle is an interned registry ID. Handles are never reused, so a handle
+// stays valid across re-registration of its ID and lookups by handle skip
+// hashing the ID string.
+type FPEHandle uint32
+
+// registryEntry owns one reference to fpe on behalf of the registry plus one
+// per in-flight user; the context is closed when the count drops to zero.
+type registryEntry struct {
+	fpe  *VoltageFPE
+	refs atomic.Int64
+}
+
+func (e *registryEntry) acquire() bool {
+	for {
+		n := e.refs.Load()
+		if n == 0 {
+			return false
+		}
+		if e.refs.CompareAndSwap(n, n+1) {
+			return true
+		}
+	}
+}
+
+func (e *registryEntry) release() {
+	if e.refs.Add(-1) == 0 {
+		e.fpe.Close()
+	}
+}
+
+// registrySnapshot is immutable once published; writers copy it, edit the copy
+// and swap it in, so readers never take a lock.
+type registrySnapshot struct {
+	handles map[string]FPEHandle
+	entries []*registryEntry
+}
+
+var (
+	registry     atomic.Pointer[registrySnapshot]
+	registryLock sync.Mutex // serializes writers only
+)
+
+func init() {
+	registry.Store(&registrySnapshot{handles: make(map[string]FPEHandle)})
+}
+
+func (s *registrySnapshot) clone() *registrySnapshot {
+	c := &registrySnapshot{
+		handles: make(map[string]FPEHandle, len(s.handles)+1),
+		entries: append([]*registryEntry(nil), s.entries...),
+	}
+	for id, h := range s.handles {
+		c.handles[id] = h
+	}
+	return c
+}
+
+// publish installs fpe under id, replacing any previous registration. The
+// replaced context is closed once its in-flight users are done.
+func publish(id string, fpe *VoltageFPE) FPEHandle {
+	h, _ := publishIf(id, fpe, nil)
+	return h
+}
+
+// publishIf is publish guarded by allow, which is evaluated under the writer
+// lock; a registration built in the background uses it so that a delete
+// that lands while it was building is not undone.
+func publishIf(id string, fpe *VoltageFPE, allow func() bool) (FPEHandle, bool) {
+	e := &registryEntry{fpe: fpe}
+	e.refs.Store(1)
+
+	registryLock.Lock()
+	if allow != nil && !allow() {
+		registryLock.Unlock()
+		return 0, false
+	}
+	next := registry.Load().clone()
+	h, ok := next.handles[id]
+	if !ok {
+		h = FPEHandle(len(next.entries))
+		next.handles[id] = h
+		next.entries = append(next.entries, nil)
+	}
+	old := next.entries[h]
+	next.entries[h] = e
+	registry.Store(next)
+	registryLock.Unlock()
+
+	if old != nil {
+		old.release()
+	}
+	return h, true
+}
+
+// replace publishes fpe under id only if id still maps to old, and reports
+// whether it did; old is closed once its in-flight users are done.
+func replace(id string, old, fpe *VoltageFPE) bool {
+	e := &registryEntry{fpe: fpe}
+	e.refs.Store(1)
+
+	registryLock.Lock()
+	current := registry.Load()
+	h, ok := current.handles[id]
+	if !ok || current.entries[h] == nil || current.entries[h].fpe != old {
+		registryLock.Unlock()
+		return false
+	}
+	prev := current.entries[h]
+	next := current.clone()
+	next.entries[h] = e
+	registry.Store(next)
+	registryLock.Unlock()
+
+	prev.release()
+	return true
+}
+
+// registeredFPE returns the context currently registered under id, if any.
+// The result is only for identity checks; it is not pinned.
+func registeredFPE(id string) *VoltageFPE {
+	s := registry.Load()
+	if h, ok := s.handles[id]; ok && s.entries[h] != nil {
+		return s.entries[h].fpe
+	}
+	return nil
+}
+
+// acquireHandle pins the entry currently registered under h. A reader that
+// races with a replacement retries against the newer snapshot.
+func acquireHandle(h FPEHandle) *registryEntry {
+	for {
+		s := registry.Load()
+		if int(h) >= len(s.entries) || s.entries[h] == nil {
+			return nil
+		}
+		if e := s.entries[h]; e.acquire() {
+			return e
+		}
+	}
+}
+
+func acquireByID(id string) (*registryEntry, error) {
+	if e := acquireRegistered(id); e != nil {
+		return e, nil
+	}
+	if r := ReadinessByID(id); r != nil {
+		if err := r.await(); err != nil {
+			return nil, err
+		}
+		if e := acquireRegistered(id); e != nil {
+			return e, nil
+		}
+	}
+	return nil, fmt.Errorf("FPE with id '%s' not found", id)
+}
+
+func acquireRegistered(id string) *registryEntry {
+	if h, ok := registry.Load().handles[id]; ok {
+		return acquireHandle(h)
+	}
+	return nil
+}
+
+func acquireByHandle(h FPEHandle) (*registryEntry, error) {
+	if e := acquireHandle(h); e != nil {
+		return e, nil
+	}
+	return nil, fmt.Errorf("FPE with handle %d not found", h)
+}
+
+// LookupFPE returns the handle interned for id, for use with the ByHandle
+// functions.
+func LookupFPE(id string) (FPEHandle, error) {
+	h, ok := registry.Load().handles[id]
+	if !ok {
+		return 0, fmt.Errorf("FPE with id '%s' not found", id)
+	}
+	return h, nil
+}
+
+func EncryptByHandle(h FPEHandle, data string) (string, error) {
+	e, err := acquireByHandle(h)
+	if err != nil {
+		return "", err
+	}
+	defer e.release()
+	return e.fpe.Protect(data), nil
+}
+
+func DecryptByHandle(h FPEHandle, cipher string) (string, error) {
+	e, err := acquireByHandle(h)
+	if err != nil {
+		return "", err
+	}
+	defer e.release()
+	return e.fpe.Access(cipher), nil
+}
+
+func EncryptBatchByHandle(h FPEHandle, values []string) ([]string, error) {
+	e, err := acquireByHandle(h)
+	if err != nil {
+		return nil, err
+	}
+	defer e.release()
+	return e.fpe.ProtectBatch(values)
+}
+
+func DecryptBatchByHandle(h FPEHandle, ciphertexts []string) ([]string, []Status, error) {
+	e, err := acquireByHandle(h)
+	if err != nil {
+		return nil, nil, err
+	}
+	defer e.release()
+	return e.fpe.AccessBatch(ciphertexts)
+}
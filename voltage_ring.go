@@ -0,0 +1,254 @@
+package main
+
+/*
+#include "voltage_fpe.h"
+*/
+import "C"
+import (
+	"errors"
+	"fmt"
+	"runtime"
+	"sync/atomic"
+	"syscall"
+	"time"
+	"unsafe"
+)
+
+const (
+	futexWaitPrivate = 128
+	futexWakePrivate = 129
+
+	ringReapSpins   = 64
+	ringReapSleepNs = 10 * int64(time.Millisecond)
+)
+
+var errRingClosed = errors.New("voltage ring is closed")
+
+type ringWaiter struct {
+	done   chan struct{}
+	status int
+	value  string
+}
+
+// RingDispatcher hands requests to pinned native workers through shared
+// memory rings, so an operation costs no cgo call: Go pushes into the request
+// ring, wakes a worker with a futex only when all of them are asleep, and a
+// reaper goroutine routes completions back to the waiting caller.
+type RingDispatcher struct {
+	fpe         *VoltageFPE
+	ring        *C.VoltageRing
+	requests    []C.VoltageRingSlot
+	completions []C.VoltageRingSlot
+	waiters     []ringWaiter
+	free        chan uint32
+	closed      atomic.Bool
+	stop        chan struct{}
+	stopped     chan struct{}
+
+	threads, capacity, firstCPU int
+}
+
+func NewRingDispatcher(fpe *VoltageFPE, threads, capacity, firstCPU int) (*RingDispatcher, error) {
+	ring := C.VoltageCreateRing(fpe.ctx, C.int(threads), C.uint(capacity), C.int(firstCPU))
+	if ring == nil {
+		return nil, fmt.Errorf("failed to start Voltage ring with %d threads and capacity %d", threads, capacity)
+	}
+	r := &RingDispatcher{
+		fpe:         fpe,
+		ring:        ring,
+		requests:    unsafe.Slice(ring.requests.slots, capacity),
+		completions: unsafe.Slice(ring.completions.slots, capacity),
+		waiters:     make([]ringWaiter, capacity),
+		free:        make(chan uint32, capacity),
+		stop:        make(chan struct{}),
+		stopped:     make(chan struct{}),
+		threads:     threads,
+		capacity:    capacity,
+		firstCPU:    firstCPU,
+	}
+	for i := range r.waiters {
+		r.waiters[i].done = make(chan struct{}, 1)
+		r.free <- uint32(i)
+	}
+	go r.reap()
+	return r, nil
+}
+
+func futexWait(addr *uint32, value uint32, timeoutNs int64) {
+	ts := syscall.NsecToTimespec(timeoutNs)
+	syscall.Syscall6(syscall.SYS_FUTEX, uintptr(unsafe.Pointer(addr)), futexWaitPrivate, uintptr(value), uintptr(unsafe.Pointer(&ts)), 0, 0)
+}
+
+func futexWake(addr *uint32) {
+	syscall.Syscall6(syscall.SYS_FUTEX, uintptr(unsafe.Pointer(addr)), futexWakePrivate, 1, 0, 0, 0)
+}
+
+func slotSequence(slot *C.VoltageRingSlot) *uint64 {
+	return (*uint64)(unsafe.Pointer(&slot.sequence))
+}
+
+// push claims a request slot with the same sequence protocol the C side uses.
+// The waiter pool never exceeds the ring capacity, so a full ring only means
+// a worker has not released its slot yet.
+func (r *RingDispatcher) push(tag uint32, op C.int, data string) {
+	head := (*uint64)(unsafe.Pointer(&r.ring.requests.head))
+	mask := uint64(r.ring.requests.mask)
+	for {
+		pos := atomic.LoadUint64(head)
+		slot := &r.requests[pos&mask]
+		dif := int64(atomic.LoadUint64(slotSequence(slot)) - pos)
+		if dif < 0 {
+			runtime.Gosched()
+			continue
+		}
+		if dif > 0 || !atomic.CompareAndSwapUint64(head, pos, pos+1) {
+			continue
+		}
+
+		slot.tag = C.uint64_t(tag)
+		slot.op = op
+		slot.status = 0
+		slot.size = C.uint32_t(len(data))
+		copy(unsafe.Slice((*byte)(unsafe.Pointer(&slot.data[0])), len(data)), data)
+		atomic.StoreUint64(slotSequence(slot), pos+1)
+
+		if atomic.LoadUint32((*uint32)(unsafe.Pointer(&r.ring.requestSleepers))) > 0 {
+			signal := (*uint32)(unsafe.Pointer(&r.ring.requestSignal))
+			atomic.AddUint32(signal, 1)
+			futexWake(signal)
+		}
+		return
+	}
+}
+
+func (r *RingDispatcher) pop() bool {
+	tail := (*uint64)(unsafe.Pointer(&r.ring.completions.tail))
+	mask := uint64(r.ring.completions.mask)
+	for {
+		pos := atomic.LoadUint64(tail)
+		slot := &r.completions[pos&mask]
+		dif := int64(atomic.LoadUint64(slotSequence(slot)) - (pos + 1))
+		if dif < 0 {
+			return false
+		}
+		if dif > 0 || !atomic.CompareAndSwapUint64(tail, pos, pos+1) {
+			continue
+		}
+
+		w := &r.waiters[slot.tag]
+		w.status = int(slot.status)
+		w.value = C.GoStringN((*C.char)(unsafe.Pointer(&slot.data[0])), C.int(slot.size))
+		atomic.StoreUint64(slotSequence(slot), pos+mask+1)
+		w.done <- struct{}{}
+		return true
+	}
+}
+
+func (r *RingDispatcher) reap() {
+	defer close(r.stopped)
+
+	sleepers := (*uint32)(unsafe.Pointer(&r.ring.completionSleepers))
+	signal := (*uint32)(unsafe.Pointer(&r.ring.completionSignal))
+	spins := 0
+	for {
+		if r.pop() {
+			spins = 0
+			continue
+		}
+		select {
+		case <-r.stop:
+			return
+		default:
+		}
+		if spins < ringReapSpins {
+			spins++
+			runtime.Gosched()
+			continue
+		}
+
+		atomic.AddUint32(sleepers, 1)
+		value := atomic.LoadUint32(signal)
+		if !r.pop() {
+			futexWait(signal, value, ringReapSleepNs)
+		}
+		atomic.AddUint32(sleepers, ^uint32(0))
+	}
+}
+
+func (r *RingDispatcher) do(op C.int, data string) (string, int, error) {
+	if len(data) > C.VOLTAGE_RING_SLOT_DATA {
+		return "", C.VE_ERROR_BUFFER_TOO_SMALL, nil
+	}
+
+	var idx uint32
+	select {
+	case idx = <-r.free:
+	case <-r.stop:
+		return "", 0, errRingClosed
+	}
+	if r.closed.Load() {
+		r.free <- idx
+		return "", 0, errRingClosed
+	}
+
+	w := &r.waiters[idx]
+	r.push(idx, op, data)
+	<-w.done
+	value, status := w.value, w.status
+	w.value = ""
+	r.free <- idx
+	if status != 0 {
+		r.fpe.noteStatus(Status(status))
+	}
+	return value, status, nil
+}
+
+func (r *RingDispatcher) Protect(data string) (string, error) {
+	value, status, err := r.do(C.VOLTAGE_DIRECTION_PROTECT, data)
+	if err == nil && status != 0 {
+		err = fmt.Errorf("voltage protect failed with status %d", status)
+	}
+	return value, err
+}
+
+func (r *RingDispatcher) Access(ciphertext string) (string, error) {
+	value, status, err := r.do(C.VOLTAGE_DIRECTION_ACCESS, ciphertext)
+	if err == nil && status != 0 {
+		err = fmt.Errorf("voltage access failed with status %d", status)
+	}
+	return value, err
+}
+
+// Close waits for in-flight requests, then stops the reaper and the native
+// workers. Callers arriving afterwards get errRingClosed.
+func (r *RingDispatcher) Close() {
+	if r.closed.Swap(true) {
+		return
+	}
+	for i := 0; i < len(r.waiters); i++ {
+		<-r.free
+	}
+	close(r.stop)
+	<-r.stopped
+	C.VoltageDestroyRing(r.ring)
+}
+
+// EnableRing routes this context's default-format Protect/Access calls
+// through a shared-memory ring served by threads native workers, pinned from
+// CPU firstCPU onwards (-1 disables pinning). capacity must be a power of two.
+func (v *VoltageFPE) EnableRing(threads, capacity, firstCPU int) error {
+	r, err := NewRingDispatcher(v, threads, capacity, firstCPU)
+	if err != nil {
+		return err
+	}
+	if old := v.ring.Swap(r); old != nil {
+		old.Close()
+	}
+	return nil
+}
+
+func (v *VoltageFPE) DisableRing() {
+	if r := v.ring.Swap(nil); r != nil {
+		r.Close()
+	}
+}
@@ -0,0 +1,176 @@
+package main
+
+/*
+#include <stdlib.h>
+#include "voltage_fpe.h"
+*/
+import "C"
+import (
+	"fmt"
+	"sync/atomic"
+	"unsafe"
+)
+
+// Status is a Simple API status code for one value; zero is success.
+type Status int
+
+const (
+	StatusOK          Status = 0
+	StatusCircuitOpen Status = C.VOLTAGE_ERROR_CIRCUIT_OPEN
+)
+
+var statusNames = map[Status]string{
+	C.VE_ERROR_MEMORY:                       "memory",
+	C.VE_ERROR_NULL_ARG:                     "null argument",
+	C.VE_ERROR_BUFFER_TOO_SMALL:             "buffer too small",
+	C.VE_ERROR_FPE_INPUT_LENGTH_ZERO:        "input is empty",
+	C.VE_ERROR_FPE_INPUT_LENGTH_TOO_SHORT:   "input too short",
+	C.VE_ERROR_FPE_INPUT_LENGTH_TOO_LONG:    "input too long",
+	C.VE_ERROR_INPUT_DOES_NOT_MATCH_FORMAT:  "input does not match format",
+	C.VE_ERROR_INPUT_OUT_OF_RANGE:           "input out of range",
+	C.VE_ERROR_CENTRALIZED_FORMAT_NOT_FOUND: "format not found",
+	C.VE_ERROR_AUTHORIZATION_DENIED:         "authorization denied",
+	C.VE_ERROR_AUTHORIZATION_EXPIRED:        "authorization expired",
+	C.VE_ERROR_CANNOT_VERIFY_CERT:           "cannot verify certificate",
+	C.VE_ERROR_NETWORK_CONNECT:              "network connect",
+	C.VE_ERROR_TIMEOUT:                      "timeout",
+	C.VOLTAGE_ERROR_POOL_CLOSED:             "worker pool closed",
+	C.VOLTAGE_ERROR_CIRCUIT_OPEN:            "key server circuit open",
+	C.VOLTAGE_ERROR_TOO_MANY_FORMATS:        "too many formats",
+}
+
+func (s Status) String() string {
+	if s == StatusOK {
+		return "ok"
+	}
+	if name, ok := statusNames[s]; ok {
+		return fmt.Sprintf("%s (%d)", name, int(s))
+	}
+	return fmt.Sprintf("status %d", int(s))
+}
+
+// Error lets a Status be wrapped in an error and recovered with errors.As.
+func (s Status) Error() string {
+	return s.String()
+}
+
+func (s Status) OK() bool {
+	return s == StatusOK
+}
+
+// userDataErrors caches VeIsFpeUserDataError per code: 0 unknown, 1 no, 2 yes.
+var userDataErrors [2048]atomic.Uint32
+
+// UserDataError reports whether the value itself was rejected, e.g. it does
+// not match the format. Such values fail the same way on every retry.
+func (s Status) UserDataError() bool {
+	if s <= 0 {
+		return false
+	}
+	if int(s) >= len(userDataErrors) {
+		return C.VeIsFpeUserDataError(C.int(s)) != 0
+	}
+	switch userDataErrors[s].Load() {
+	case 1:
+		return false
+	case 2:
+		return true
+	}
+	yes := C.VeIsFpeUserDataError(C.int(s)) != 0
+	if yes {
+		userDataErrors[s].Store(2)
+	} else {
+		userDataErrors[s].Store(1)
+	}
+	return yes
+}
+
+// Retryable reports whether the failure was environmental, so the same value
+// may succeed if tried again later.
+func (s Status) Retryable() bool {
+	switch s {
+	case C.VE_ERROR_MEMORY, C.VE_ERROR_NETWORK_CONNECT, C.VE_ERROR_TIMEOUT, C.VE_ERROR_AUTHORIZATION_EXPIRED,
+		C.VOLTAGE_ERROR_CIRCUIT_OPEN:
+		return true
+	}
+	return false
+}
+
+func toStatuses(cStatuses []C.int) []Status {
+	statuses := make([]Status, len(cStatuses))
+	for i, st := range cStatuses {
+		statuses[i] = Status(st)
+	}
+	return statuses
+}
+
+const errorDetailsSize = 4096
+
+// errorDetails repeats a failed operation in one native call and returns the
+// vendor's formatted error details for it. The returned status is that of the
+// repeat, so a transient failure may come back as StatusOK with no details.
+// When the repeat could not run, the details are the status's own text.
+func (v *VoltageFPE) errorDetails(direction C.int, format, value, tweak string, masked bool) (Status, string) {
+	input, inputSize := cInput(value)
+	var cTweak *C.uchar
+	var tweakSize C.uint
+	if tweak != "" {
+		cTweak, tweakSize = cInput(tweak)
+	}
+	var cMasked C.int
+	if masked {
+		cMasked = 1
+	}
+	name, owned := v.cFormat(format)
+	if owned {
+		defer C.free(unsafe.Pointer(name))
+	}
+	details := make([]byte, errorDetailsSize)
+	status := C.VoltageErrorDetails(v.ctx, name, direction, cMasked, input, inputSize, cTweak, tweakSize,
+		(*C.char)(unsafe.Pointer(&details[0])), C.uint(len(details)))
+	text := C.GoString((*C.char)(unsafe.Pointer(&details[0])))
+	if status != 0 && text == "" {
+		text = Status(status).String()
+	}
+	return Status(status), text
+}
+
+// ProtectErrorDetails explains why protecting value failed. Details are
+// costly to format, so batch callers fetch them only for the items they log.
+func (v *VoltageFPE) ProtectErrorDetails(format, value, tweak string) (Status, string) {
+	return v.errorDetails(C.VOLTAGE_DIRECTION_PROTECT, format, value, tweak, false)
+}
+
+func (v *VoltageFPE) AccessErrorDetails(format, ciphertext, tweak string, masked bool) (Status, string) {
+	return v.errorDetails(C.VOLTAGE_DIRECTION_ACCESS, format, ciphertext, tweak, masked)
+}
+
+// ProtectStatus is Protect with the status of the call instead of an empty
+// result on failure.
+func (v *VoltageFPE) ProtectStatus(data string) (string, Status) {
+	return v.call(true, data)
+}
+
+func (v *VoltageFPE) AccessStatus(ciphertext string) (string, Status) {
+	return v.call(false, ciphertext)
+}
+
+func ProtectErrorDetailsByID(id, format, value, tweak string) (Status, string, error) {
+	e, err := acquireByID(id)
+	if err != nil {
+		return StatusOK, "", err
+	}
+	defer e.release()
+	status, details := e.fpe.ProtectErrorDetails(format, value, tweak)
+	return status, details, nil
+}
+
+func AccessErrorDetailsByID(id, format, ciphertext, tweak string, masked bool) (Status, string, error) {
+	e, err := acquireByID(id)
+	if err != nil {
+		return StatusOK, "", err
+	}
+	defer e.release()
+	status, details := e.fpe.AccessErrorDetails(format, ciphertext, tweak, masked)
+	return status, details, nil
+}
@@ -0,0 +1,264 @@
+package main
+
+/*
+#include <stdlib.h>
+#include "voltage_fpe.h"
+*/
+import "C"
+import (
+	"crypto/tls"
+	"crypto/x509"
+	"fmt"
+	"io"
+	"net/http"
+	"os"
+	"path/filepath"
+	"time"
+	"unsafe"
+)
+
+// ContextConfig is the Go form of VoltageContextConfig.
+type ContextConfig struct {
+	PolicyURL      string
+	PolicyFilePath string
+	TrustStorePath string
+	CachePath      string
+	Identity       string
+	SharedSecret   string
+	Format         string
+
+	// NetworkTimeout bounds each key-server call; zero keeps the vendor
+	// default. It is rounded up to whole seconds and must not exceed
+	// maxNetworkTimeout, the vendor's limit. Calls failing with a network error are retried Retries times
+	// with jittered exponential backoff starting at RetryBackoff.
+	NetworkTimeout time.Duration
+	Retries        int
+	RetryBackoff   time.Duration
+
+	// After BreakerThreshold consecutive network failures key fetches fail
+	// fast with StatusCircuitOpen for BreakerCooldown. Zero disables it.
+	BreakerThreshold int
+	BreakerCooldown  time.Duration
+}
+
+// ContextError reports why a context could not be created. Status.Retryable
+// tells a transient key-server outage from a configuration error.
+type ContextError struct {
+	Status Status
+}
+
+func (e *ContextError) Error() string {
+	return "failed to init Voltage FPE context: " + e.Status.String()
+}
+
+func (e *ContextError) Unwrap() error {
+	return e.Status
+}
+
+// NewVoltageFPEWithConfig creates a context from c. Unlike NewVoltageFPE it
+// returns a failure, a *ContextError, instead of panicking, so a key-server
+// outage at startup can be retried.
+func NewVoltageFPEWithConfig(c ContextConfig) (*VoltageFPE, error) {
+	return newVoltageFPEFromConfig(c)
+}
+
+func newVoltageFPEFromConfig(c ContextConfig) (*VoltageFPE, error) {
+	if c.NetworkTimeout < 0 || c.NetworkTimeout > maxNetworkTimeout {
+		return nil, fmt.Errorf("network timeout %v is outside the supported range (0, %v]", c.NetworkTimeout, maxNetworkTimeout)
+	}
+
+	var strs []*C.char
+	cString := func(s string) *C.char {
+		p := C.CString(s)
+		strs = append(strs, p)
+		return p
+	}
+	defer func() {
+		for _, p := range strs {
+			C.free(unsafe.Pointer(p))
+		}
+	}()
+
+	config := C.VoltageContextConfig{
+		policyURL:      cString(c.PolicyURL),
+		policyFilePath: cString(c.PolicyFilePath),
+		trustStorePath: cString(c.TrustStorePath),
+		cachePath:      cString(c.CachePath),
+		identity:       cString(c.Identity),
+		sharedSecret:   cString(c.SharedSecret),
+		format:         cString(c.Format),
+
+		networkTimeout:    C.int((c.NetworkTimeout + time.Second - 1) / time.Second),
+		retries:           C.uint(max(c.Retries, 0)),
+		retryBackoffMs:    C.uint(c.RetryBackoff.Milliseconds()),
+		breakerThreshold:  C.uint(max(c.BreakerThreshold, 0)),
+		breakerCooldownMs: C.uint(c.BreakerCooldown.Milliseconds()),
+	}
+	var status C.int
+	cCtx := C.CreateVoltageFPEContextWithConfig(&config, &status)
+	if cCtx == nil {
+		return nil, &ContextError{Status: Status(status)}
+	}
+	return &VoltageFPE{ctx: cCtx, config: c}, nil
+}
+
+const (
+	maxNetworkTimeout = 300 * time.Second
+
+	policySnapshotName    = "clientPolicy.xml"
+	policyFetchTimeout    = 30 * time.Second
+	policyRefreshMinDelay = time.Second
+	policyRefreshMaxDelay = time.Minute
+)
+
+// RegisterFPEWarm registers id from a local snapshot of the client policy
+// when one exists, so a restart needs neither the policy server nor the key
+// server: keys come from the file cache in c.CachePath. It then downloads the
+// policy in the background, persists it for the next start, and swaps in a
+// context built from c.PolicyURL. Without a snapshot it starts online and
+// only persists the policy. snapshotPath defaults to clientPolicy.xml in
+// c.CachePath.
+func RegisterFPEWarm(id string, c ContextConfig, snapshotPath string) error {
+	if snapshotPath == "" {
+		snapshotPath = filepath.Join(c.CachePath, policySnapshotName)
+	}
+	online := c
+	online.PolicyFilePath = ""
+
+	if _, err := os.Stat(snapshotPath); err == nil {
+		offline := online
+		offline.PolicyFilePath = snapshotPath
+		if fpe, err := newVoltageFPEFromConfig(offline); err == nil {
+			fpe.fromSnapshot = true
+			publish(id, fpe)
+			go refreshFromPolicyURL(id, fpe, online, snapshotPath)
+			return nil
+		}
+	}
+
+	fpe, err := newVoltageFPEFromConfig(online)
+	if err != nil {
+		return err
+	}
+	publish(id, fpe)
+	go refreshFromPolicyURL(id, fpe, online, snapshotPath)
+	return nil
+}
+
+// refreshFromPolicyURL persists the current policy and, if current was
+// started from a snapshot, replaces it with an online context. It retries
+// with backoff until it succeeds or id no longer maps to current.
+func refreshFromPolicyURL(id string, current *VoltageFPE, c ContextConfig, snapshotPath string) {
+	delay := policyRefreshMinDelay
+	for registeredFPE(id) == current {
+		err := refreshOnce(id, current, c, snapshotPath)
+		if err == nil {
+			return
+		}
+		time.Sleep(delay)
+		delay = min(2*delay, policyRefreshMaxDelay)
+	}
+}
+
+// refreshOnce downloads the policy and only persists it once a context has
+// been built from the downloaded copy, so a policy the vendor library cannot
+// load never replaces a good snapshot. The online replacement inherits the
+// snapshot context's warmed formats, coalescing, ring and expiry settings.
+func refreshOnce(id string, current *VoltageFPE, c ContextConfig, snapshotPath string) error {
+	policy, err := fetchPolicy(c.PolicyURL, c.TrustStorePath)
+	if err != nil {
+		return err
+	}
+	staged, err := stageSnapshot(snapshotPath, policy)
+	if err != nil {
+		return err
+	}
+	defer os.Remove(staged)
+
+	check := c
+	check.PolicyFilePath = staged
+	probe, err := newVoltageFPEFromConfig(check)
+	if err != nil {
+		return fmt.Errorf("downloaded policy from %s does not load: %w", c.PolicyURL, err)
+	}
+	probe.Close()
+	if err := os.Rename(staged, snapshotPath); err != nil {
+		return err
+	}
+	if !current.fromSnapshot {
+		return nil
+	}
+
+	fpe, err := newVoltageFPEFromConfig(c)
+	if err != nil {
+		return err
+	}
+	if err := fpe.inherit(current); err != nil {
+		fpe.Close()
+		return err
+	}
+	if !replace(id, current, fpe) {
+		fpe.Close()
+	}
+	return nil
+}
+
+// fetchPolicy downloads the policy trusting only the certificates in the
+// Voltage trust store, the same roots the vendor library verifies against.
+func fetchPolicy(url, trustStorePath string) ([]byte, error) {
+	entries, err := os.ReadDir(trustStorePath)
+	if err != nil {
+		return nil, err
+	}
+	roots := x509.NewCertPool()
+	trusted := false
+	for _, e := range entries {
+		if pem, err := os.ReadFile(filepath.Join(trustStorePath, e.Name())); err == nil {
+			trusted = roots.AppendCertsFromPEM(pem) || trusted
+		}
+	}
+	if !trusted {
+		return nil, fmt.Errorf("no certificates in trust store %s", trustStorePath)
+	}
+	client := &http.Client{
+		Timeout:   policyFetchTimeout,
+		Transport: &http.Transport{TLSClientConfig: &tls.Config{RootCAs: roots}},
+	}
+	resp, err := client.Get(url)
+	if err != nil {
+		return nil, err
+	}
+	defer resp.Body.Close()
+	if resp.StatusCode != http.StatusOK {
+		return nil, fmt.Errorf("fetching policy %s: %s", url, resp.Status)
+	}
+	policy, err := io.ReadAll(resp.Body)
+	if err != nil {
+		return nil, err
+	}
+	if len(policy) == 0 {
+		return nil, fmt.Errorf("fetching policy %s: empty response", url)
+	}
+	return policy, nil
+}
+
+// stageSnapshot writes data to a synced temporary file next to path and
+// returns its name; renaming it over path then replaces the snapshot
+// atomically, so a crash never leaves a truncated policy for the next start.
+func stageSnapshot(path string, data []byte) (string, error) {
+	tmp, err := os.CreateTemp(filepath.Dir(path), filepath.Base(path)+".*")
+	if err != nil {
+		return "", err
+	}
+	if _, err = tmp.Write(data); err == nil {
+		err = tmp.Sync()
+	}
+	if cerr := tmp.Close(); err == nil {
+		err = cerr
+	}
+	if err != nil {
+		os.Remove(tmp.Name())
+		return "", err
+	}
+	return tmp.Name(), nil
+}